@@ -16,6 +16,8 @@
 #include <math.h>
 #include <hidsdi.h>
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 
 #define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
@@ -26,6 +28,37 @@
 
 static HWND g_hWnd;
 
+struct _DEVICE_CONTEXT *AcquireDeviceContext(HANDLE hDevice);
+void ReleaseDeviceContext(HANDLE hDevice);
+
+static LRESULT CALLBACK SDL_HelperWindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	char buf[1024];
+	switch (msg)
+	{
+		case WM_INPUT_DEVICE_CHANGE:
+		{
+			HANDLE hDevice = (HANDLE)lParam;
+			switch (wParam) {
+			case GIDC_ARRIVAL:
+				sprintf_s(buf, "Device %08p: Added\n", hDevice);
+				AcquireDeviceContext(hDevice);
+				break;
+			case GIDC_REMOVAL:
+				sprintf_s(buf, "Device %08p: Removed\n", hDevice);
+				ReleaseDeviceContext(hDevice);
+				break;
+			default:
+				return 0;
+			}
+			OutputDebugStringA(buf);
+		}
+		return 0;
+	}
+	return DefWindowProc(hWnd, msg, wParam, lParam);
+}
+
+
 static WCHAR *SDL_HelperWindowClassName = TEXT("SDLHelperWindowInputCatcher");
 static WCHAR *SDL_HelperWindowName = TEXT("SDLHelperWindowInputMsgWindow");
 static ATOM SDL_HelperWindowClass = 0;
@@ -41,7 +74,7 @@ int SDL_HelperWindowCreate(void)
 	}
 
 	/* Create the class. */
-	wce.lpfnWndProc = DefWindowProc;
+	wce.lpfnWndProc = SDL_HelperWindowProc;
 	wce.lpszClassName = (LPCWSTR)SDL_HelperWindowClassName;
 	wce.hInstance = hInstance;
 
@@ -74,116 +107,949 @@ int SDL_HelperWindowCreate(void)
 // Global variables
 //
 
-BOOL bButtonStates[MAX_BUTTONS];
-LONG lAxisX;
-LONG lAxisY;
-LONG lAxisZ;
-LONG lAxisRz;
-LONG lHat;
-INT  g_NumberOfButtons;
+HANDLE g_hLastDevice;		// device of the latest decoded report
+UINT   g_VerifySampleRate;	// see "Shadow verification"
 
 
-void ParseRawInput(PRAWINPUT pRawInput)
+//
+// Usage filters
+//
+// Every subscriber declares up front which controls it reads, e.g.
+//
+//   static const INPUT_FILTER StickFilter = { FIELD_X | FIELD_Y, 4 };
+//
+// for the X/Y axes and buttons 1-4. The filters of all subscribers are merged
+// into g_FieldPlan, and ParseRawInputReport only extracts what the plan
+// contains; a device's value caps are reduced to the planned ones once per
+// plan change rather than filtered on every report.
+//
+
+#define FIELD_X			0x0001
+#define FIELD_Y			0x0002
+#define FIELD_Z			0x0004
+#define FIELD_RZ		0x0008
+#define FIELD_HAT		0x0010
+#define FIELD_ALL		(FIELD_X | FIELD_Y | FIELD_Z | FIELD_RZ | FIELD_HAT)
+
+typedef struct _INPUT_FILTER
 {
-	PHIDP_PREPARSED_DATA pPreparsedData;
+	DWORD dwFields;			// FIELD_* of the values to extract
+	INT   NumberOfButtons;	// buttons 1 to NumberOfButtons are extracted
+} INPUT_FILTER, *PINPUT_FILTER;
+
+INPUT_FILTER g_FieldPlan;
+UINT         g_FieldPlanVersion;
+
+
+DWORD UsageField(USAGE usage)
+{
+	switch(usage)
+	{
+	case 0x30:	return FIELD_X;
+	case 0x31:	return FIELD_Y;
+	case 0x32:	return FIELD_Z;
+	case 0x35:	return FIELD_RZ;
+	case 0x39:	return FIELD_HAT;
+	}
+	return 0;
+}
+
+
+//
+// Input subscribers
+//
+// Consumers subscribe with a delivery policy instead of being woken up for
+// every report:
+//
+//   DELIVER_LATEST  one notification per burst, g_hLastDevice has the latest state
+//   DELIVER_EDGES   every button press and release is queued as an INPUT_EDGE,
+//                   with the device it came from; one notification per report
+//                   that changed a button
+//   DELIVER_EVERY   every report is queued as an INPUT_EVENT
+//
+// Queues are bounded, and edges or events that do not fit are counted in
+// dwOverflow.
+//
+// Edges and events only cover the subscriber's own filter; the fields of an
+// INPUT_EVENT outside of it are left undefined.
+//
+// Edge detection and event snapshots are only done while a subscriber with
+// the matching policy exists.
+//
+
+#define MAX_SUBSCRIBERS		8
+
+typedef enum _DELIVERY_POLICY
+{
+	DELIVER_LATEST,
+	DELIVER_EDGES,
+	DELIVER_EVERY
+} DELIVERY_POLICY;
+
+typedef struct _INPUT_EVENT
+{
+	HANDLE hDevice;
+	BOOL   bButtonStates[MAX_BUTTONS];
+	LONG   lAxisX;
+	LONG   lAxisY;
+	LONG   lAxisZ;
+	LONG   lAxisRz;
+	LONG   lHat;
+	LONGLONG qwTimestamp;		// QueryPerformanceCounter when the report arrived
+} INPUT_EVENT, *PINPUT_EVENT;
+
+typedef struct _INPUT_EDGE
+{
+	HANDLE   hDevice;
+	INT      Button;			// 1 to MAX_BUTTONS
+	BOOL     bPressed;
+	LONGLONG qwTimestamp;		// QueryPerformanceCounter when the report arrived
+} INPUT_EDGE, *PINPUT_EDGE;
+
+typedef struct _SUBSCRIBER *PSUBSCRIBER;
+typedef void (*PINPUT_NOTIFY)(PSUBSCRIBER pSubscriber);
+
+typedef struct _SUBSCRIBER
+{
+	DELIVERY_POLICY Policy;
+	INPUT_FILTER    Filter;
+	PINPUT_NOTIFY   pfnNotify;
+	BOOL            bPending;
+	PINPUT_EVENT    pQueue;			// DELIVER_EVERY
+	PINPUT_EDGE     pEdges;			// DELIVER_EDGES
+	UINT            queueLength;
+	UINT            queueHead;
+	UINT            queueCount;
+	DWORD           dwOverflow;
+} SUBSCRIBER;
+
+SUBSCRIBER g_Subscribers[MAX_SUBSCRIBERS];
+UINT       g_NumberOfSubscribers;
+DWORD      g_SubscribedPolicies;
+
+
+PSUBSCRIBER Subscribe(DELIVERY_POLICY Policy, const INPUT_FILTER *pFilter, PINPUT_NOTIFY pfnNotify, UINT queueLength)
+{
+	PSUBSCRIBER pSubscriber;
+
+	if(g_NumberOfSubscribers == MAX_SUBSCRIBERS)
+		return NULL;
+
+	pSubscriber = &g_Subscribers[g_NumberOfSubscribers];
+	ZeroMemory(pSubscriber, sizeof(*pSubscriber));
+	pSubscriber->Policy    = Policy;
+	pSubscriber->Filter    = *pFilter;
+	pSubscriber->pfnNotify = pfnNotify;
+	if(pSubscriber->Filter.NumberOfButtons > MAX_BUTTONS)
+		pSubscriber->Filter.NumberOfButtons = MAX_BUTTONS;
+
+	if(Policy == DELIVER_EVERY)
+	{
+		if(queueLength == 0)
+			return NULL;
+		pSubscriber->pQueue = (PINPUT_EVENT)HeapAlloc(GetProcessHeap(), 0, sizeof(INPUT_EVENT) * queueLength);
+		if(!pSubscriber->pQueue)
+			return NULL;
+		pSubscriber->queueLength = queueLength;
+	}
+	else if(Policy == DELIVER_EDGES)
+	{
+		if(queueLength == 0)
+			return NULL;
+		pSubscriber->pEdges = (PINPUT_EDGE)HeapAlloc(GetProcessHeap(), 0, sizeof(INPUT_EDGE) * queueLength);
+		if(!pSubscriber->pEdges)
+			return NULL;
+		pSubscriber->queueLength = queueLength;
+	}
+
+	g_NumberOfSubscribers++;
+	g_SubscribedPolicies |= 1 << Policy;
+
+	g_FieldPlan.dwFields |= pSubscriber->Filter.dwFields;
+	if(pSubscriber->Filter.NumberOfButtons > g_FieldPlan.NumberOfButtons)
+		g_FieldPlan.NumberOfButtons = pSubscriber->Filter.NumberOfButtons;
+	g_FieldPlanVersion++;
+
+	return pSubscriber;
+}
+
+
+BOOL PopInputEvent(PSUBSCRIBER pSubscriber, PINPUT_EVENT pEvent)
+{
+	if(pSubscriber->queueCount == 0)
+		return FALSE;
+
+	*pEvent = pSubscriber->pQueue[pSubscriber->queueHead];
+	pSubscriber->queueHead = (pSubscriber->queueHead + 1) % pSubscriber->queueLength;
+	pSubscriber->queueCount--;
+	return TRUE;
+}
+
+
+BOOL PopInputEdge(PSUBSCRIBER pSubscriber, PINPUT_EDGE pEdge)
+{
+	if(pSubscriber->queueCount == 0)
+		return FALSE;
+
+	*pEdge = pSubscriber->pEdges[pSubscriber->queueHead];
+	pSubscriber->queueHead = (pSubscriber->queueHead + 1) % pSubscriber->queueLength;
+	pSubscriber->queueCount--;
+	return TRUE;
+}
+
+
+//
+// Called at the end of a burst of reports
+//
+
+void FlushSubscribers(void)
+{
+	UINT i;
+
+	for(i = 0; i < g_NumberOfSubscribers; i++)
+	{
+		if(g_Subscribers[i].bPending)
+		{
+			g_Subscribers[i].bPending = FALSE;
+			g_Subscribers[i].pfnNotify(&g_Subscribers[i]);
+		}
+	}
+}
+
+
+//
+// Per-device decode context: the preparsed data and input caps that have to
+// be fetched from a device before any of its reports can be decoded, and the
+// state decoded from its latest report.
+//
+// All of it lives in a single heap block per device, sized from HIDP_CAPS:
+//
+//   [preparsed data][button caps][value caps][value plan][verify data][verify values]
+//
+// so a device's metadata is contiguous and goes away with one HeapFree. The
+// verify data and values are only reserved while shadow verification is
+// enabled.
+//
+
+#define ARENA_ALIGN(cb)		(((cb) + 7) & ~7)
+
+// Devices with several input reports prefix each with its report ID, and
+// every cap belongs to one of them; report ID 0 means the device has only one
+#define IN_REPORT(pCaps, pRawInput)	(!(pCaps)->ReportID || (pCaps)->ReportID == (pRawInput)->data.hid.bRawData[0])
+
+typedef struct _DEVICE_CONTEXT
+{
+	HANDLE               hDevice;
+	UINT                 cbArena;
+	PHIDP_PREPARSED_DATA pPreparsedData;		// start of the arena
+	UINT                 cbPreparsedData;
 	HIDP_CAPS            Caps;
 	PHIDP_BUTTON_CAPS    pButtonCaps;
 	PHIDP_VALUE_CAPS     pValueCaps;
-	USHORT               capsLength;
-	UINT                 bufferSize;
-	HANDLE               hHeap;
-	USAGE                usage[MAX_BUTTONS];
-	ULONG                i, usageLength, value;
+	INT                  NumberOfButtons;
+	PUSHORT              pValuePlan;			// indices into pValueCaps
+	USHORT               NumberOfPlannedValues;
+	INT                  NumberOfPlannedButtons;
+	UINT                 PlanVersion;
+	PHIDP_DATA           pVerifyData;
+	ULONG                VerifyDataLength;
+	PULONG               pVerifyValues;		// raw value per value cap, as last decoded
+	BOOL                 bVerifyLogged;		// preparsed data is in the mismatch log
+
+	BOOL                 bButtonStates[MAX_BUTTONS];
+	BOOL                 bLastButtonStates[MAX_BUTTONS];	// as of the last edge
+	LONG                 lAxisX;
+	LONG                 lAxisY;
+	LONG                 lAxisZ;
+	LONG                 lAxisRz;
+	LONG                 lHat;
+} DEVICE_CONTEXT, *PDEVICE_CONTEXT;
+
+
+UINT g_DeviceArenaBytes;
+
+
+void CloseDeviceContext(PDEVICE_CONTEXT pContext)
+{
+	HANDLE hHeap = GetProcessHeap();
+
+	g_DeviceArenaBytes -= pContext->cbArena;
+	pContext->cbArena     = 0;
+	pContext->pButtonCaps = NULL;
+	pContext->pValueCaps  = NULL;
+	pContext->pValuePlan  = NULL;
+	pContext->pVerifyData = NULL;
+	pContext->pVerifyValues = NULL;
+	SAFE_FREE(pContext->pPreparsedData);
+}
 
-	pPreparsedData = NULL;
-	pButtonCaps    = NULL;
-	pValueCaps     = NULL;
-	hHeap          = GetProcessHeap();
+
+//
+// Reduce the device's value caps to the ones the current field plan needs
+//
+
+void PlanDeviceContext(PDEVICE_CONTEXT pContext)
+{
+	USHORT i;
+
+	pContext->NumberOfPlannedButtons = pContext->NumberOfButtons;
+	if(pContext->NumberOfPlannedButtons > g_FieldPlan.NumberOfButtons)
+		pContext->NumberOfPlannedButtons = g_FieldPlan.NumberOfButtons;
+
+	pContext->NumberOfPlannedValues = 0;
+	for(i = 0; i < pContext->Caps.NumberInputValueCaps; i++)
+	{
+		if(g_FieldPlan.dwFields & UsageField(pContext->pValueCaps[i].Range.UsageMin))
+			pContext->pValuePlan[pContext->NumberOfPlannedValues++] = i;
+	}
+	pContext->PlanVersion = g_FieldPlanVersion;
+}
+
+
+BOOL OpenDeviceContext(HANDLE hDevice, PDEVICE_CONTEXT pContext)
+{
+	PBYTE  pArena;
+	USHORT capsLength;
+	UINT   bufferSize, cbButtonCaps, cbValueCaps, cbValuePlan, cbVerifyData, cbVerifyValues, cbArena;
+	HANDLE hHeap;
+
+	ZeroMemory(pContext, sizeof(*pContext));
+	pContext->hDevice = hDevice;
+	hHeap             = GetProcessHeap();
 
 	//
 	// Get the preparsed data block
 	//
 
-	CHECK( GetRawInputDeviceInfo(pRawInput->header.hDevice, RIDI_PREPARSEDDATA, NULL, &bufferSize) == 0 );
-	CHECK( pPreparsedData = (PHIDP_PREPARSED_DATA)HeapAlloc(hHeap, 0, bufferSize) );
-	CHECK( (int)GetRawInputDeviceInfo(pRawInput->header.hDevice, RIDI_PREPARSEDDATA, pPreparsedData, &bufferSize) >= 0 );
+	CHECK( GetRawInputDeviceInfo(hDevice, RIDI_PREPARSEDDATA, NULL, &bufferSize) == 0 );
+	CHECK( pContext->pPreparsedData = (PHIDP_PREPARSED_DATA)HeapAlloc(hHeap, 0, bufferSize) );
+	CHECK( (int)GetRawInputDeviceInfo(hDevice, RIDI_PREPARSEDDATA, pContext->pPreparsedData, &bufferSize) >= 0 );
 
 	//
-	// Get the joystick's capabilities
+	// Get the joystick's capabilities and grow the block into the arena.
+	// Preparsed data holds no pointers into itself, so it may move.
 	//
 
+	CHECK( HidP_GetCaps(pContext->pPreparsedData, &pContext->Caps) == HIDP_STATUS_SUCCESS )
+
+	if(g_VerifySampleRate)
+		pContext->VerifyDataLength = HidP_MaxDataListLength(HidP_Input, pContext->pPreparsedData);
+
+	cbButtonCaps = ARENA_ALIGN(sizeof(HIDP_BUTTON_CAPS) * pContext->Caps.NumberInputButtonCaps);
+	cbValueCaps  = ARENA_ALIGN(sizeof(HIDP_VALUE_CAPS) * pContext->Caps.NumberInputValueCaps);
+	cbValuePlan  = ARENA_ALIGN(sizeof(USHORT) * pContext->Caps.NumberInputValueCaps);
+	cbVerifyData = ARENA_ALIGN(sizeof(HIDP_DATA) * pContext->VerifyDataLength);
+	cbVerifyValues = g_VerifySampleRate ? ARENA_ALIGN(sizeof(ULONG) * pContext->Caps.NumberInputValueCaps) : 0;
+	cbArena      = ARENA_ALIGN(bufferSize) + cbButtonCaps + cbValueCaps + cbValuePlan + cbVerifyData + cbVerifyValues;
+
+	CHECK( pArena = (PBYTE)HeapReAlloc(hHeap, 0, pContext->pPreparsedData, cbArena) );
+	pContext->pPreparsedData  = (PHIDP_PREPARSED_DATA)pArena;
+	pContext->cbPreparsedData = bufferSize;
+	pContext->cbArena         = cbArena;
+	g_DeviceArenaBytes       += cbArena;
+
+	pArena += ARENA_ALIGN(bufferSize);
+	pContext->pButtonCaps = (PHIDP_BUTTON_CAPS)pArena;
+	pArena += cbButtonCaps;
+	pContext->pValueCaps  = (PHIDP_VALUE_CAPS)pArena;
+	pArena += cbValueCaps;
+	pContext->pValuePlan  = (PUSHORT)pArena;
+	pArena += cbValuePlan;
+	if(pContext->VerifyDataLength)
+		pContext->pVerifyData = (PHIDP_DATA)pArena;
+	pArena += cbVerifyData;
+	if(cbVerifyValues)
+		pContext->pVerifyValues = (PULONG)pArena;
+
 	// Button caps
-	CHECK( HidP_GetCaps(pPreparsedData, &Caps) == HIDP_STATUS_SUCCESS )
-	CHECK( pButtonCaps = (PHIDP_BUTTON_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_BUTTON_CAPS) * Caps.NumberInputButtonCaps) );
+	capsLength = pContext->Caps.NumberInputButtonCaps;
+	CHECK( HidP_GetButtonCaps(HidP_Input, pContext->pButtonCaps, &capsLength, pContext->pPreparsedData) == HIDP_STATUS_SUCCESS )
 
-	capsLength = Caps.NumberInputButtonCaps;
-	CHECK( HidP_GetButtonCaps(HidP_Input, pButtonCaps, &capsLength, pPreparsedData) == HIDP_STATUS_SUCCESS )
-	g_NumberOfButtons = pButtonCaps->Range.UsageMax - pButtonCaps->Range.UsageMin + 1;
+	// Pedals and the like have no buttons, and no more than MAX_BUTTONS are decoded
+	if(pContext->Caps.NumberInputButtonCaps)
+	{
+		pContext->NumberOfButtons = 1;
+		if(pContext->pButtonCaps->IsRange)
+			pContext->NumberOfButtons = pContext->pButtonCaps->Range.UsageMax - pContext->pButtonCaps->Range.UsageMin + 1;
+	}
+	if(pContext->NumberOfButtons < 0)
+		pContext->NumberOfButtons = 0;
+	if(pContext->NumberOfButtons > MAX_BUTTONS)
+		pContext->NumberOfButtons = MAX_BUTTONS;
 
 	// Value caps
-	CHECK( pValueCaps = (PHIDP_VALUE_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_VALUE_CAPS) * Caps.NumberInputValueCaps) );
-	capsLength = Caps.NumberInputValueCaps;
-	CHECK( HidP_GetValueCaps(HidP_Input, pValueCaps, &capsLength, pPreparsedData) == HIDP_STATUS_SUCCESS )
+	capsLength = pContext->Caps.NumberInputValueCaps;
+	CHECK( HidP_GetValueCaps(HidP_Input, pContext->pValueCaps, &capsLength, pContext->pPreparsedData) == HIDP_STATUS_SUCCESS )
+	PlanDeviceContext(pContext);
+
+	return TRUE;
+
+Error:
+	CloseDeviceContext(pContext);
+	return FALSE;
+}
+
+
+//
+// Device context cache
+//
+// A device's preparsed data and caps do not change while it is attached, so
+// its context is built on arrival or first use and released on GIDC_REMOVAL,
+// before another device can reuse the handle. Entries whose handle no longer
+// resolves are also pruned when the table fills up. The cache only lives as
+// long as the process, so building the contexts at startup costs what it
+// always did.
+//
+
+#define MAX_DEVICES		32
+
+DEVICE_CONTEXT g_Devices[MAX_DEVICES];
+UINT           g_NumberOfDevices;
+
+
+void LogDeviceArenas(PDEVICE_CONTEXT pContext)
+{
+	char buf[256];
+
+	if(pContext)
+	{
+		sprintf_s(buf, "Device %08p: %u byte arena (%u button caps, %u value caps)\n",
+			pContext->hDevice, pContext->cbArena, pContext->Caps.NumberInputButtonCaps, pContext->Caps.NumberInputValueCaps);
+		OutputDebugStringA(buf);
+	}
+	sprintf_s(buf, "Device arenas: %u bytes for %u devices\n", g_DeviceArenaBytes, g_NumberOfDevices);
+	OutputDebugStringA(buf);
+}
+
+
+PDEVICE_CONTEXT FindDeviceContext(HANDLE hDevice)
+{
+	UINT i;
+
+	for(i = 0; i < g_NumberOfDevices; i++)
+	{
+		if(g_Devices[i].hDevice == hDevice)
+			return &g_Devices[i];
+	}
+	return NULL;
+}
+
+
+void ReleaseDeviceContext(HANDLE hDevice)
+{
+	PDEVICE_CONTEXT pContext;
+
+	pContext = FindDeviceContext(hDevice);
+	if(!pContext)
+		return;
+
+	CloseDeviceContext(pContext);
+	*pContext = g_Devices[--g_NumberOfDevices];
+	LogDeviceArenas(NULL);
+}
+
+
+void PruneDeviceContexts(void)
+{
+	UINT i, bufferSize;
+
+	for(i = 0; i < g_NumberOfDevices; )
+	{
+		if(GetRawInputDeviceInfo(g_Devices[i].hDevice, RIDI_PREPARSEDDATA, NULL, &bufferSize) != 0)
+			ReleaseDeviceContext(g_Devices[i].hDevice);
+		else
+			i++;
+	}
+}
+
+
+PDEVICE_CONTEXT AcquireDeviceContext(HANDLE hDevice)
+{
+	PDEVICE_CONTEXT pContext;
+
+	pContext = FindDeviceContext(hDevice);
+	if(pContext)
+		return pContext;
+
+	if(g_NumberOfDevices == MAX_DEVICES)
+	{
+		PruneDeviceContexts();
+		if(g_NumberOfDevices == MAX_DEVICES)
+			return NULL;
+	}
+
+	pContext = &g_Devices[g_NumberOfDevices];
+	if(!OpenDeviceContext(hDevice, pContext))
+		return NULL;
+
+	g_NumberOfDevices++;
+	LogDeviceArenas(pContext);
+	return pContext;
+}
+
+
+//
+// Shadow verification
+//
+// One in g_VerifySampleRate successfully decoded reports is decoded a second
+// time through HidP_GetData and compared field by field with what
+// ParseRawInputReport produced, so a decoder that gets a bit offset wrong
+// shows up instead of silently corrupting input.
+// 0 disables the check; it is set with "-verify N" on the command line.
+//
+// Mismatches are appended to a log in the capture file format of the
+// Messaged sample, so they outlive the session and RawInputDecode can decode
+// the offending reports: the device's preparsed data before its first
+// mismatch, then per mismatching report a CAPTURE_MISMATCH record
+// describing every field that differs, followed by the report. The log is "-mismatchlog <file>", by default
+// RawInputVerify.rcap in the temp directory, and is only created once
+// something mismatches.
+//
+
+#define MAX_VERIFY_FIELDS	768		// characters of mismatching field descriptions per report
+
+#define CAPTURE_MAGIC		0x50414352	// "RCAP"
+#define CAPTURE_VERSION		1
+#define CAPTURE_DEVICE		1
+#define CAPTURE_REPORT		2
+#define CAPTURE_MISMATCH	4
+#define CAPTURE_SESSION		5
+
+typedef struct _CAPTURE_FILE_HEADER
+{
+	DWORD     dwMagic;
+	DWORD     dwVersion;
+	ULONGLONG qwFrequency;		// QueryPerformanceFrequency of the timestamps
+} CAPTURE_FILE_HEADER;
+
+typedef struct _CAPTURE_RECORD_HEADER
+{
+	DWORD     dwType;
+	DWORD     cbData;
+	ULONGLONG qwDevice;			// hDevice in the capturing session
+	ULONGLONG qwTimestamp;		// QueryPerformanceCounter when the record was written
+} CAPTURE_RECORD_HEADER;
+
+// Payload of CAPTURE_SESSION
+typedef struct _CAPTURE_SESSION_INFO
+{
+	ULONGLONG qwFrequency;		// QueryPerformanceFrequency of the session's timestamps
+	DWORD     dwAxisMapping;	// CAPTURE_AXES_*
+	DWORD     dwReserved;
+} CAPTURE_SESSION_INFO;
+
+#define CAPTURE_AXES_MESSAGED	0	// Z 0x33, Rz 0x34, (value - 32768) / 256
+#define CAPTURE_AXES_BUFFERED	1	// Z 0x32, Rz 0x35, value - 128
+
+UINT  g_VerifyCounter;
+UINT  g_VerifyMismatches;
+FILE *g_pVerifyLog;
+char  g_szVerifyLog[MAX_PATH];
+
+
+void WriteCaptureHeader(FILE *pFile)
+{
+	CAPTURE_FILE_HEADER header;
+	LARGE_INTEGER       frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	header.dwMagic     = CAPTURE_MAGIC;
+	header.dwVersion   = CAPTURE_VERSION;
+	header.qwFrequency = frequency.QuadPart;
+	fwrite(&header, sizeof(header), 1, pFile);
+}
+
+
+void WriteCaptureRecord(FILE *pFile, DWORD dwType, HANDLE hDevice, const void *pData, DWORD cbData)
+{
+	CAPTURE_RECORD_HEADER header;
+	LARGE_INTEGER         now;
+
+	if(!pFile)
+		return;
+
+	QueryPerformanceCounter(&now);
+	header.dwType      = dwType;
+	header.cbData      = cbData;
+	header.qwDevice    = (ULONGLONG)(ULONG_PTR)hDevice;
+	header.qwTimestamp = now.QuadPart;
+	fwrite(&header, sizeof(header), 1, pFile);
+	fwrite(pData, 1, cbData, pFile);
+}
+
+
+void WriteCaptureSession(FILE *pFile)
+{
+	CAPTURE_SESSION_INFO session;
+	LARGE_INTEGER        frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	ZeroMemory(&session, sizeof(session));
+	session.qwFrequency   = frequency.QuadPart;
+	session.dwAxisMapping = CAPTURE_AXES_BUFFERED;
+	WriteCaptureRecord(pFile, CAPTURE_SESSION, NULL, &session, sizeof(session));
+}
+
+
+BOOL OpenVerifyLog(void)
+{
+	if(g_pVerifyLog)
+		return TRUE;
+	if(fopen_s(&g_pVerifyLog, g_szVerifyLog, "ab") != 0)
+		return FALSE;
+
+	// Sessions append to the same log, only a new one gets a header, and
+	// every session starts with its own timestamp base
+	_fseeki64(g_pVerifyLog, 0, SEEK_END);
+	if(_ftelli64(g_pVerifyLog) == 0)
+		WriteCaptureHeader(g_pVerifyLog);
+	WriteCaptureSession(g_pVerifyLog);
+	return TRUE;
+}
+
+
+void LogVerifyMismatch(PDEVICE_CONTEXT pContext, PRAWINPUT pRawInput, UINT fieldCount, const char *pszFields)
+{
+	RID_DEVICE_INFO info;
+	UINT            size;
+	char            buf[MAX_VERIFY_FIELDS + 256];
+	char           *out;
+
+	g_VerifyMismatches++;
+
+	ZeroMemory(&info, sizeof(info));
+	info.cbSize = size = sizeof(info);
+	GetRawInputDeviceInfo(pContext->hDevice, RIDI_DEVICEINFO, &info, &size);
+
+	_snprintf_s(buf, sizeof(buf), _TRUNCATE, "Verify mismatch #%u, device %08p (VID %04X PID %04X, usage %02X:%02X, %u byte reports), %u fields: %s\n",
+		g_VerifyMismatches, pContext->hDevice, info.hid.dwVendorId, info.hid.dwProductId,
+		pContext->Caps.UsagePage, pContext->Caps.Usage, pContext->Caps.InputReportByteLength, fieldCount, pszFields);
+	OutputDebugStringA(buf);
+
+	if(OpenVerifyLog())
+	{
+		if(!pContext->bVerifyLogged)
+		{
+			WriteCaptureRecord(g_pVerifyLog, CAPTURE_DEVICE, pContext->hDevice, pContext->pPreparsedData, pContext->cbPreparsedData);
+			pContext->bVerifyLogged = TRUE;
+		}
+		WriteCaptureRecord(g_pVerifyLog, CAPTURE_MISMATCH, pContext->hDevice, buf, (DWORD)strlen(buf));
+		WriteCaptureRecord(g_pVerifyLog, CAPTURE_REPORT, pContext->hDevice, &pRawInput->data.hid,
+			FIELD_OFFSET(RAWHID, bRawData) + pRawInput->data.hid.dwSizeHid * pRawInput->data.hid.dwCount);
+		fflush(g_pVerifyLog);
+	}
+
+	strcpy_s(buf, sizeof(buf), "Report: ");
+	out = buf + strlen(buf);
+	for (unsigned int ii = 0; ii < pRawInput->data.hid.dwSizeHid && out + 4 < buf + sizeof(buf); ii++) {
+		unsigned char byte = pRawInput->data.hid.bRawData[ii];
+		sprintf_s(out, 3, "%02X", byte);
+		out += 2;
+	}
+	*out++ = '\n';
+	*out++ = 0;
+	OutputDebugStringA(buf);
+}
+
+
+//
+// Appends the description of a mismatching field, cut short if there are
+// too many to describe
+//
+
+void AddVerifyField(char *pszFields, UINT *pFieldCount, const char *pszField)
+{
+	if (*pFieldCount)
+		strncat_s(pszFields, MAX_VERIFY_FIELDS, "; ", _TRUNCATE);
+	strncat_s(pszFields, MAX_VERIFY_FIELDS, pszField, _TRUNCATE);
+	(*pFieldCount)++;
+}
+
+
+void VerifyRawInputReport(PDEVICE_CONTEXT pContext, PRAWINPUT pRawInput)
+{
+	PHIDP_DATA        pData;
+	PHIDP_BUTTON_CAPS pButtonCaps;
+	PHIDP_VALUE_CAPS  pValueCaps;
+	PULONG            pValues;
+	BOOL              bReference[MAX_BUTTONS];
+	ULONG             dataLength, i, j, k;
+	USHORT            indexMin, indexMax;
+	UINT              fieldCount;
+	char              field[128];
+	char              fields[MAX_VERIFY_FIELDS];
+
+	pData   = pContext->pVerifyData;
+	pValues = pContext->pVerifyValues;
+	if (!pData)
+		return;
+
+	pButtonCaps = pContext->pButtonCaps;
+	pValueCaps  = pContext->pValueCaps;
+	dataLength  = pContext->VerifyDataLength;
+	fieldCount  = 0;
+	fields[0]   = 0;
+
+	if (HidP_GetData(HidP_Input, pData, &dataLength, pContext->pPreparsedData,
+		(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid) != HIDP_STATUS_SUCCESS)
+	{
+		LogVerifyMismatch(pContext, pRawInput, 1, "HidP_GetData failed");
+		return;
+	}
 
 	//
-	// Get the pressed buttons
+	// Buttons: the data list only holds the ones that are down
 	//
 
-	usageLength = g_NumberOfButtons;
-	NTSTATUS ret = HidP_GetUsages(
-		HidP_Input, pButtonCaps->UsagePage, 0, usage, &usageLength, pPreparsedData,
-		(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid
-	);
-	CHECK( ret == HIDP_STATUS_SUCCESS );
+	if (pContext->NumberOfPlannedButtons > 0 && IN_REPORT(pButtonCaps, pRawInput))
+	{
+		ZeroMemory(bReference, sizeof(bReference));
+		indexMin = pButtonCaps->Range.DataIndexMin;
+		indexMax = pButtonCaps->IsRange ? pButtonCaps->Range.DataIndexMax : indexMin;
+
+		for (j = 0; j < dataLength; j++)
+		{
+			if (pData[j].DataIndex >= indexMin && pData[j].DataIndex <= indexMax && pData[j].DataIndex - indexMin < MAX_BUTTONS)
+				bReference[pData[j].DataIndex - indexMin] = pData[j].On;
+		}
+
+		for (i = 0; i < (ULONG)pContext->NumberOfPlannedButtons; i++)
+		{
+			if (!pContext->bButtonStates[i] != !bReference[i])
+			{
+				sprintf_s(field, "button %u: fast %d, reference %d", i + 1, !!pContext->bButtonStates[i], !!bReference[i]);
+				AddVerifyField(fields, &fieldCount, field);
+			}
+		}
+	}
+
+	//
+	// Values: compare the raw, unscaled value of every planned value cap
+	//
+
+	for (k = 0; k < pContext->NumberOfPlannedValues; k++)
+	{
+		i = pContext->pValuePlan[k];
+		if (!IN_REPORT(&pValueCaps[i], pRawInput))
+			continue;
+
+		for (j = 0; j < dataLength; j++)
+		{
+			if (pData[j].DataIndex == pValueCaps[i].Range.DataIndexMin)
+				break;
+		}
+
+		if (j == dataLength)
+		{
+			sprintf_s(field, "usage %02X:%02X: fast %lu, reference missing", pValueCaps[i].UsagePage, pValueCaps[i].Range.UsageMin, pValues[i]);
+			AddVerifyField(fields, &fieldCount, field);
+		}
+		else if (pData[j].RawValue != pValues[i])
+		{
+			sprintf_s(field, "usage %02X:%02X: fast %lu, reference %lu", pValueCaps[i].UsagePage, pValueCaps[i].Range.UsageMin, pValues[i], pData[j].RawValue);
+			AddVerifyField(fields, &fieldCount, field);
+		}
+	}
+
+	// One record per mismatching report, however many of its fields differ
+	if (fieldCount)
+		LogVerifyMismatch(pContext, pRawInput, fieldCount, fields);
+}
 
-	ZeroMemory(bButtonStates, sizeof(bButtonStates));
-	for(i = 0; i < usageLength; i++)
-		bButtonStates[usage[i] - pButtonCaps->Range.UsageMin] = TRUE;
+
+BOOL ParseRawInputReport(PDEVICE_CONTEXT pContext, PRAWINPUT pRawInput)
+{
+	PHIDP_PREPARSED_DATA pPreparsedData;
+	PHIDP_BUTTON_CAPS    pButtonCaps;
+	PHIDP_VALUE_CAPS     pValueCaps;
+	USAGE                usage[MAX_BUTTONS];
+	ULONG                i, j, usageLength, value;
+
+	pPreparsedData = pContext->pPreparsedData;
+	pButtonCaps    = pContext->pButtonCaps;
+	pValueCaps     = pContext->pValueCaps;
+
+	if(pContext->PlanVersion != g_FieldPlanVersion)
+		PlanDeviceContext(pContext);
 
 	//
-	// Get the state of discrete-valued-controls
+	// Get the pressed buttons. Controls that are not in this report keep the
+	// state their own report last set.
 	//
 
-	for(i = 0; i < Caps.NumberInputValueCaps; i++)
+	if(pContext->NumberOfPlannedButtons > 0 && IN_REPORT(pButtonCaps, pRawInput))
 	{
+		usageLength = pContext->NumberOfButtons;
+		NTSTATUS ret = HidP_GetUsages(
+			HidP_Input, pButtonCaps->UsagePage, 0, usage, &usageLength, pPreparsedData,
+			(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid
+		);
+		CHECK( ret == HIDP_STATUS_SUCCESS );
+
+		ZeroMemory(pContext->bButtonStates, sizeof(pContext->bButtonStates));
+		for(i = 0; i < usageLength; i++)
+		{
+			j = usage[i] - pButtonCaps->Range.UsageMin;
+			if(j < (ULONG)pContext->NumberOfPlannedButtons)
+				pContext->bButtonStates[j] = TRUE;
+		}
+	}
+
+	//
+	// Get the state of the planned discrete-valued-controls
+	//
+
+	for(j = 0; j < pContext->NumberOfPlannedValues; j++)
+	{
+		i = pContext->pValuePlan[j];
+		if(!IN_REPORT(&pValueCaps[i], pRawInput))
+			continue;
+
 		CHECK(
 			HidP_GetUsageValue(
 				HidP_Input, pValueCaps[i].UsagePage, 0, pValueCaps[i].Range.UsageMin, &value, pPreparsedData,
 				(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid
 			) == HIDP_STATUS_SUCCESS );
 
+		if(pContext->pVerifyValues)
+			pContext->pVerifyValues[i] = value;
+
 		switch(pValueCaps[i].Range.UsageMin)
 		{
 		case 0x30:	// X-axis
-			lAxisX = (LONG)value - 128;
+			pContext->lAxisX = (LONG)value - 128;
 			break;
 
 		case 0x31:	// Y-axis
-			lAxisY = (LONG)value - 128;
+			pContext->lAxisY = (LONG)value - 128;
 			break;
 
 		case 0x32: // Z-axis
-			lAxisZ = (LONG)value - 128;
+			pContext->lAxisZ = (LONG)value - 128;
 			break;
 
 		case 0x35: // Rotate-Z
-			lAxisRz = (LONG)value - 128;
+			pContext->lAxisRz = (LONG)value - 128;
 			break;
 
 		case 0x39:	// Hat Switch
-			lHat = value;
+			pContext->lHat = value;
 			break;
 		}
 	}
 
-	//
-	// Clean up
-	//
+	if(g_VerifySampleRate && ++g_VerifyCounter >= g_VerifySampleRate)
+	{
+		g_VerifyCounter = 0;
+		VerifyRawInputReport(pContext, pRawInput);
+	}
+
+	return TRUE;
 
 Error:
-	SAFE_FREE(pPreparsedData);
-	SAFE_FREE(pButtonCaps);
-	SAFE_FREE(pValueCaps);
+	return FALSE;
+}
+
+
+//
+// Called once for every successfully decoded report. Edges are detected
+// against the same device's previous buttons, and DELIVER_LATEST
+// notifications read the state of the device in g_hLastDevice.
+//
+
+void PublishInput(PDEVICE_CONTEXT pContext, LONGLONG qwTimestamp)
+{
+	PSUBSCRIBER  pSubscriber;
+	PINPUT_EVENT pEvent;
+	PINPUT_EDGE  pEdge;
+	INT          firstEdge, button;
+	UINT         i;
+
+	g_hLastDevice = pContext->hDevice;
+
+	// Lowest button that changed, edge subscribers whose buttons all lie below
+	// it are skipped with one comparison
+	firstEdge = MAX_BUTTONS;
+	if(g_SubscribedPolicies & (1 << DELIVER_EDGES))
+	{
+		for(firstEdge = 0; firstEdge < pContext->NumberOfPlannedButtons; firstEdge++)
+		{
+			if(pContext->bLastButtonStates[firstEdge] != pContext->bButtonStates[firstEdge])
+				break;
+		}
+		if(firstEdge == pContext->NumberOfPlannedButtons)
+			firstEdge = MAX_BUTTONS;
+	}
+
+	for(i = 0; i < g_NumberOfSubscribers; i++)
+	{
+		pSubscriber = &g_Subscribers[i];
+
+		switch(pSubscriber->Policy)
+		{
+		case DELIVER_LATEST:
+			pSubscriber->bPending = TRUE;
+			break;
+
+		case DELIVER_EDGES:
+			if(firstEdge >= pSubscriber->Filter.NumberOfButtons)
+				break;
+			for(button = firstEdge; button < pSubscriber->Filter.NumberOfButtons && button < pContext->NumberOfPlannedButtons; button++)
+			{
+				if(pContext->bLastButtonStates[button] == pContext->bButtonStates[button])
+					continue;
+				if(pSubscriber->queueCount == pSubscriber->queueLength)
+				{
+					pSubscriber->dwOverflow++;
+					continue;
+				}
+				pEdge = &pSubscriber->pEdges[(pSubscriber->queueHead + pSubscriber->queueCount) % pSubscriber->queueLength];
+				pEdge->hDevice     = pContext->hDevice;
+				pEdge->Button      = button + 1;
+				pEdge->bPressed    = pContext->bButtonStates[button];
+				pEdge->qwTimestamp = qwTimestamp;
+				pSubscriber->queueCount++;
+			}
+			pSubscriber->pfnNotify(pSubscriber);
+			break;
+
+		case DELIVER_EVERY:
+			if(pSubscriber->queueCount == pSubscriber->queueLength)
+			{
+				pSubscriber->dwOverflow++;
+				break;
+			}
+			pEvent = &pSubscriber->pQueue[(pSubscriber->queueHead + pSubscriber->queueCount) % pSubscriber->queueLength];
+			pEvent->hDevice = pContext->hDevice;
+			CopyMemory(pEvent->bButtonStates, pContext->bButtonStates, sizeof(BOOL) * pSubscriber->Filter.NumberOfButtons);
+			pEvent->lAxisX  = pContext->lAxisX;
+			pEvent->lAxisY  = pContext->lAxisY;
+			pEvent->lAxisZ  = pContext->lAxisZ;
+			pEvent->lAxisRz = pContext->lAxisRz;
+			pEvent->lHat    = pContext->lHat;
+			pEvent->qwTimestamp = qwTimestamp;
+			pSubscriber->queueCount++;
+			pSubscriber->bPending = TRUE;
+			break;
+		}
+	}
+
+	// Only now that every subscriber has its edges
+	if(firstEdge < MAX_BUTTONS)
+		CopyMemory(pContext->bLastButtonStates, pContext->bButtonStates, sizeof(BOOL) * pContext->NumberOfPlannedButtons);
+}
+
+
+void ParseRawInput(PRAWINPUT pRawInput, LONGLONG qwTimestamp)
+{
+	PDEVICE_CONTEXT pContext;
+
+	pContext = AcquireDeviceContext(pRawInput->header.hDevice);
+	if(!pContext)
+		return;
+
+	if(ParseRawInputReport(pContext, pRawInput))
+		PublishInput(pContext, qwTimestamp);
 }
 
 
@@ -263,18 +1129,34 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			// Draw the buttons and axis-values
 			//
 
-			PAINTSTRUCT ps;
-			HDC         hDC;
-			int         i;
+			static DEVICE_CONTEXT NoDevice;
+			PDEVICE_CONTEXT       pContext;
+			PAINTSTRUCT           ps;
+			HDC                   hDC;
+			int                   i;
+
+			// The device that reported last
+			pContext = FindDeviceContext(g_hLastDevice);
+			if(!pContext)
+				pContext = &NoDevice;
 
 			hDC = BeginPaint(hWnd, &ps);
 			SetBkMode(hDC, TRANSPARENT);
 
-			for(i = 0; i < g_NumberOfButtons; i++)
-				DrawButton(hDC, i+1, 20 + i * 40, 20, bButtonStates[i]);
-			DrawCrosshair(hDC, 20, 100, lAxisX, lAxisY);
-			DrawCrosshair(hDC, 296, 100, lAxisZ, lAxisRz);
-			DrawDPad(hDC, 600, 140, lHat);
+			for(i = 0; i < pContext->NumberOfPlannedButtons; i++)
+				DrawButton(hDC, i+1, 20 + i * 40, 20, pContext->bButtonStates[i]);
+			DrawCrosshair(hDC, 20, 100, pContext->lAxisX, pContext->lAxisY);
+			DrawCrosshair(hDC, 296, 100, pContext->lAxisZ, pContext->lAxisRz);
+			DrawDPad(hDC, 600, 140, pContext->lHat);
+
+			if(g_VerifySampleRate)
+			{
+				char sz[MAX_PATH + 128];
+
+				sprintf_s(sz, "Verifying 1 in %u reports: %u mismatching reports, logged to %s",
+					g_VerifySampleRate, g_VerifyMismatches, g_szVerifyLog);
+				TextOutA(hDC, 20, 380, sz, (int)strlen(sz));
+			}
 
 			EndPaint(hWnd, &ps);
 		}
@@ -288,8 +1170,23 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 	return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
+
+void RepaintNotify(PSUBSCRIBER pSubscriber)
+{
+	InvalidateRect(g_hWnd, NULL, TRUE);
+	UpdateWindow(g_hWnd);
+}
+
 void CALLBACK tick(HWND hWnd, UINT Arg2, UINT_PTR Arg3, DWORD Arg4)
 {
+	MSG msg;
+
+	// The message loop only pumps the main window, so device changes for the
+	// helper window are dispatched here. A removed device's context is then
+	// gone before a new device on the same handle gets decoded.
+	while (PeekMessage(&msg, SDL_HelperWindow, WM_INPUT_DEVICE_CHANGE, WM_INPUT_DEVICE_CHANGE, PM_REMOVE))
+		DispatchMessage(&msg);
+
 	UINT cbSize;
 	UINT ret = GetRawInputBuffer(NULL, &cbSize, sizeof(RAWINPUTHEADER));
 	assert(ret == 0);
@@ -304,7 +1201,6 @@ void CALLBACK tick(HWND hWnd, UINT Arg2, UINT_PTR Arg3, DWORD Arg4)
 		assert(!"Not enough memory");
 		return;
 	}
-	bool dirty = false;
 	for (;;)
 	{
 		UINT cbSizeT = cbSize;
@@ -313,32 +1209,37 @@ void CALLBACK tick(HWND hWnd, UINT Arg2, UINT_PTR Arg3, DWORD Arg4)
 			break;
 		}
 		assert(nInput != (UINT)-1);
+
+		// Every report of the batch was waiting by the time it was read
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+
 		PRAWINPUT* paRawInput = (PRAWINPUT*)malloc(sizeof(PRAWINPUT) * nInput);
 		if (paRawInput == NULL)
 		{
 			assert(!"Not enough memory");
 			break;
 		}
+		// Records are decoded and published one at a time, in the order they
+		// arrived, on this thread. Subscribers see every device's reports in
+		// that order, so decoding is not spread over worker threads.
 		PRAWINPUT pri = pRawInput;
 		for (UINT i = 0; i < nInput; ++i)
 		{
-			dirty = true;
 			pri->data.hid.dwSizeHid = pri->header.dwSize - sizeof(RAWINPUTHEADER) - sizeof(DWORD) * 4;
-			ParseRawInput(pri);
 			paRawInput[i] = pri;
+			ParseRawInput(pri, now.QuadPart);
 
 			pri = NEXTRAWINPUTBLOCK(pri);
 		}
+
 		// to clean the buffer
 		DefRawInputProc(paRawInput, nInput, sizeof(RAWINPUTHEADER));
 
 		free(paRawInput);
 	}
 	free(pRawInput);
-	if (dirty) {
-		InvalidateRect(g_hWnd, NULL, TRUE);
-		UpdateWindow(g_hWnd);
-	}
+	FlushSubscribers();
 }
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
@@ -346,7 +1247,32 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	HWND hWnd;
 	MSG msg;
 	WNDCLASSEX wcex;
+	LPSTR pszArg;
+
+
+	//
+	// Optional shadow verification, "-verify N" checks 1 in N reports
+	//
 
+	pszArg = strstr(lpCmdLine, "-verify");
+	if(pszArg)
+	{
+		g_VerifySampleRate = strtoul(pszArg + strlen("-verify"), NULL, 10);
+		if(g_VerifySampleRate == 0)
+			g_VerifySampleRate = 1;
+	}
+
+	pszArg = strstr(lpCmdLine, "-mismatchlog ");
+	if(pszArg)
+	{
+		if(sscanf_s(pszArg, "-mismatchlog %259s", g_szVerifyLog, (unsigned)sizeof(g_szVerifyLog)) != 1)
+			return -1;
+	}
+	else
+	{
+		GetTempPathA(MAX_PATH, g_szVerifyLog);
+		strcat_s(g_szVerifyLog, "RawInputVerify.rcap");
+	}
 
 	SDL_HelperWindowCreate();
 
@@ -359,12 +1285,12 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
 	rid[0].usUsagePage = 1;
 	rid[0].usUsage = 4;	// Joystick
-	rid[0].dwFlags = RIDEV_INPUTSINK; // Receive messages when in background
+	rid[0].dwFlags = RIDEV_DEVNOTIFY | RIDEV_INPUTSINK; // Receive messages when in background
 	rid[0].hwndTarget = SDL_HelperWindow;
 
 	rid[1].usUsagePage = 1;
 	rid[1].usUsage = 5;	// Gamepad - e.g. XBox 360 or XBox One controllers
-	rid[1].dwFlags = RIDEV_INPUTSINK; // Receive messages when in background
+	rid[1].dwFlags = RIDEV_DEVNOTIFY | RIDEV_INPUTSINK; // Receive messages when in background
 	rid[1].hwndTarget = SDL_HelperWindow;
 
 	if (!RegisterRawInputDevices(&rid[0], 2, sizeof(RAWINPUTDEVICE)))
@@ -398,6 +1324,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	ShowWindow(hWnd, nShowCmd);
 	UpdateWindow(hWnd);
 
+	static const INPUT_FILTER RepaintFilter = { FIELD_ALL, MAX_BUTTONS };
+	Subscribe(DELIVER_LATEST, &RepaintFilter, RepaintNotify, 0);
+
 	//
 	// Message loop
 	//
@@ -409,5 +1338,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 		DispatchMessage(&msg);
 	}
 
+	if(g_pVerifyLog)
+		fclose(g_pVerifyLog);
+
 	return (int)msg.wParam;
 }
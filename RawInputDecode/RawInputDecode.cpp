@@ -0,0 +1,696 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Offline decoder for capture files written by the Raw Input sample
+// ("Raw Input.exe -capture <file>")
+//
+// Streams the capture through the same decode as ParseRawInput and writes
+// the decoded per-device state and button edges as CSV. Reading, decoding
+// and writing run on separate threads connected by bounded block queues, so
+// captures of any size are processed in constant memory.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include <Windows.h>
+#include <hidsdi.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define MAX_BUTTONS		128
+#define MAX_DEVICES		256
+#define MAX_LINE		1024
+#define BLOCK_SIZE		(1024 * 1024)
+#define QUEUE_DEPTH		4
+#define CHECK(exp)		{ if(!(exp)) goto Error; }
+#define SAFE_FREE(p)	{ if(p) { HeapFree(hHeap, 0, p); (p) = NULL; } }
+
+// Devices with several input reports prefix each with its report ID, and
+// every cap belongs to one of them; report ID 0 means the device has only one
+#define IN_REPORT(pCaps, pReport)	(!(pCaps)->ReportID || (pCaps)->ReportID == (UCHAR)(pReport)[0])
+
+
+//
+// Capture file format, see RawInputMessaged/RawInput.cpp
+//
+
+#define CAPTURE_MAGIC		0x50414352	// "RCAP"
+#define CAPTURE_VERSION		1
+#define CAPTURE_DEVICE		1
+#define CAPTURE_REPORT		2
+#define CAPTURE_REMOVAL		3
+#define CAPTURE_MISMATCH	4
+#define CAPTURE_SESSION		5
+
+typedef struct _CAPTURE_FILE_HEADER
+{
+	DWORD     dwMagic;
+	DWORD     dwVersion;
+	ULONGLONG qwFrequency;		// QueryPerformanceFrequency of the timestamps
+} CAPTURE_FILE_HEADER;
+
+typedef struct _CAPTURE_RECORD_HEADER
+{
+	DWORD     dwType;
+	DWORD     cbData;
+	ULONGLONG qwDevice;			// hDevice in the capturing session
+	ULONGLONG qwTimestamp;		// QueryPerformanceCounter when the record was written
+} CAPTURE_RECORD_HEADER;
+
+typedef struct _CAPTURE_SESSION_INFO
+{
+	ULONGLONG qwFrequency;		// QueryPerformanceFrequency of the session's timestamps
+	DWORD     dwAxisMapping;	// CAPTURE_AXES_*
+	DWORD     dwReserved;
+} CAPTURE_SESSION_INFO;
+
+#define CAPTURE_AXES_MESSAGED	0	// Z 0x33, Rz 0x34, (value - 32768) / 256
+#define CAPTURE_AXES_BUFFERED	1	// Z 0x32, Rz 0x35, value - 128
+
+
+//
+// Block queues
+//
+// Single producer, single consumer. Every stage boundary has a queue of
+// filled blocks going forward and a queue of free blocks coming back, so the
+// number of blocks in flight, and with it the memory use, is fixed. A NULL
+// block marks the end of the stream.
+//
+
+typedef struct _BLOCK
+{
+	DWORD cbUsed;
+	BYTE  data[BLOCK_SIZE];
+} BLOCK, *PBLOCK;
+
+typedef struct _BLOCK_QUEUE
+{
+	PBLOCK Slots[QUEUE_DEPTH];
+	UINT   head;
+	UINT   tail;
+	HANDLE hFilled;
+	HANDLE hEmpty;
+} BLOCK_QUEUE, *PBLOCK_QUEUE;
+
+
+void PushBlock(PBLOCK_QUEUE pQueue, PBLOCK pBlock)
+{
+	WaitForSingleObject(pQueue->hEmpty, INFINITE);
+	pQueue->Slots[pQueue->tail] = pBlock;
+	pQueue->tail = (pQueue->tail + 1) % QUEUE_DEPTH;
+	ReleaseSemaphore(pQueue->hFilled, 1, NULL);
+}
+
+
+PBLOCK PopBlock(PBLOCK_QUEUE pQueue)
+{
+	PBLOCK pBlock;
+
+	WaitForSingleObject(pQueue->hFilled, INFINITE);
+	pBlock = pQueue->Slots[pQueue->head];
+	pQueue->head = (pQueue->head + 1) % QUEUE_DEPTH;
+	ReleaseSemaphore(pQueue->hEmpty, 1, NULL);
+	return pBlock;
+}
+
+
+BOOL InitBlockQueue(PBLOCK_QUEUE pQueue, BOOL bFill)
+{
+	PBLOCK pBlock;
+	UINT   i;
+
+	ZeroMemory(pQueue, sizeof(*pQueue));
+	CHECK( pQueue->hFilled = CreateSemaphore(NULL, 0, QUEUE_DEPTH, NULL) );
+	CHECK( pQueue->hEmpty = CreateSemaphore(NULL, QUEUE_DEPTH, QUEUE_DEPTH, NULL) );
+
+	// Free lists start out holding every block of their stage
+	for(i = 0; bFill && i < QUEUE_DEPTH; i++)
+	{
+		CHECK( pBlock = (PBLOCK)HeapAlloc(GetProcessHeap(), 0, sizeof(BLOCK)) );
+		PushBlock(pQueue, pBlock);
+	}
+	return TRUE;
+
+Error:
+	return FALSE;
+}
+
+
+//
+// Global variables
+//
+
+BLOCK_QUEUE g_ReadQueue;		// reader -> decoder
+BLOCK_QUEUE g_ReadFree;
+BLOCK_QUEUE g_WriteQueue;		// decoder -> writer
+BLOCK_QUEUE g_WriteFree;
+PBLOCK      g_pOutput;
+
+ULONGLONG   g_qwFrequency;
+ULONGLONG   g_qwFirstTimestamp;		// of the current session
+DWORD       g_dwAxisMapping;		// of the current session, captures without one are Messaged
+ULONGLONG   g_qwReports;
+ULONGLONG   g_qwErrors;
+
+
+//
+// Per-device decode state
+//
+
+typedef struct _DEVICE
+{
+	ULONGLONG            qwDevice;
+	PHIDP_PREPARSED_DATA pPreparsedData;
+	HIDP_CAPS            Caps;
+	PHIDP_BUTTON_CAPS    pButtonCaps;
+	PHIDP_VALUE_CAPS     pValueCaps;
+	INT                  NumberOfButtons;
+
+	BOOL                 bButtonStates[MAX_BUTTONS];
+	LONG                 lAxisX;
+	LONG                 lAxisY;
+	LONG                 lAxisZ;
+	LONG                 lAxisRz;
+	LONG                 lHat;
+} DEVICE, *PDEVICE;
+
+DEVICE g_Devices[MAX_DEVICES];
+UINT   g_NumberOfDevices;
+
+
+void CloseDevice(PDEVICE pDevice)
+{
+	HANDLE hHeap = GetProcessHeap();
+
+	SAFE_FREE(pDevice->pPreparsedData);
+	SAFE_FREE(pDevice->pButtonCaps);
+	SAFE_FREE(pDevice->pValueCaps);
+}
+
+
+PDEVICE FindDevice(ULONGLONG qwDevice)
+{
+	UINT i;
+
+	for(i = 0; i < g_NumberOfDevices; i++)
+	{
+		if(g_Devices[i].qwDevice == qwDevice)
+			return &g_Devices[i];
+	}
+	return NULL;
+}
+
+
+//
+// A CAPTURE_DEVICE record: the preparsed data is all HidP_* needs, the
+// device itself does not have to be present
+//
+
+BOOL OpenDevice(ULONGLONG qwDevice, const BYTE *pData, DWORD cbData)
+{
+	PDEVICE pDevice;
+	USHORT  capsLength;
+	HANDLE  hHeap;
+
+	// Handles can be reused after a hotplug, the newest profile wins
+	pDevice = FindDevice(qwDevice);
+	if(pDevice)
+		CloseDevice(pDevice);
+	else if(g_NumberOfDevices < MAX_DEVICES)
+		pDevice = &g_Devices[g_NumberOfDevices++];
+	else
+		return FALSE;
+
+	ZeroMemory(pDevice, sizeof(*pDevice));
+	pDevice->qwDevice = qwDevice;
+	hHeap             = GetProcessHeap();
+
+	CHECK( pDevice->pPreparsedData = (PHIDP_PREPARSED_DATA)HeapAlloc(hHeap, 0, cbData) );
+	CopyMemory(pDevice->pPreparsedData, pData, cbData);
+
+	CHECK( HidP_GetCaps(pDevice->pPreparsedData, &pDevice->Caps) == HIDP_STATUS_SUCCESS )
+	CHECK( pDevice->pButtonCaps = (PHIDP_BUTTON_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_BUTTON_CAPS) * pDevice->Caps.NumberInputButtonCaps) );
+
+	capsLength = pDevice->Caps.NumberInputButtonCaps;
+	CHECK( HidP_GetButtonCaps(HidP_Input, pDevice->pButtonCaps, &capsLength, pDevice->pPreparsedData) == HIDP_STATUS_SUCCESS )
+
+	// Pedals and the like have no buttons, and a capture may come from a
+	// device with more than MAX_BUTTONS or be corrupt
+	if(pDevice->Caps.NumberInputButtonCaps)
+	{
+		pDevice->NumberOfButtons = 1;
+		if(pDevice->pButtonCaps->IsRange)
+			pDevice->NumberOfButtons = pDevice->pButtonCaps->Range.UsageMax - pDevice->pButtonCaps->Range.UsageMin + 1;
+	}
+	if(pDevice->NumberOfButtons < 0)
+		pDevice->NumberOfButtons = 0;
+	if(pDevice->NumberOfButtons > MAX_BUTTONS)
+		pDevice->NumberOfButtons = MAX_BUTTONS;
+
+	CHECK( pDevice->pValueCaps = (PHIDP_VALUE_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_VALUE_CAPS) * pDevice->Caps.NumberInputValueCaps) );
+	capsLength = pDevice->Caps.NumberInputValueCaps;
+	CHECK( HidP_GetValueCaps(HidP_Input, pDevice->pValueCaps, &capsLength, pDevice->pPreparsedData) == HIDP_STATUS_SUCCESS )
+
+	return TRUE;
+
+Error:
+	// Keep the slot so later reports from this handle are counted as errors
+	CloseDevice(pDevice);
+	return FALSE;
+}
+
+
+//
+// A CAPTURE_REMOVAL record
+//
+
+void RemoveDevice(ULONGLONG qwDevice)
+{
+	PDEVICE pDevice;
+
+	pDevice = FindDevice(qwDevice);
+	if(!pDevice)
+		return;
+
+	CloseDevice(pDevice);
+	*pDevice = g_Devices[--g_NumberOfDevices];
+}
+
+
+//
+// Same decode as ParseRawInputReport, into the device's own state
+//
+
+BOOL DecodeReport(PDEVICE pDevice, PCHAR pReport, ULONG cbReport)
+{
+	PHIDP_BUTTON_CAPS pButtonCaps;
+	PHIDP_VALUE_CAPS  pValueCaps;
+	USAGE             usage[MAX_BUTTONS];
+	ULONG             i, j, usageLength, value;
+
+	pButtonCaps = pDevice->pButtonCaps;
+	pValueCaps  = pDevice->pValueCaps;
+	if(!pDevice->pPreparsedData)
+		return FALSE;
+
+	// Controls that are not in this report keep the state their own report last set
+	if(pDevice->NumberOfButtons > 0 && IN_REPORT(pButtonCaps, pReport))
+	{
+		usageLength = pDevice->NumberOfButtons;
+		CHECK(
+			HidP_GetUsages(
+				HidP_Input, pButtonCaps->UsagePage, 0, usage, &usageLength, pDevice->pPreparsedData,
+				pReport, cbReport
+			) == HIDP_STATUS_SUCCESS );
+
+		ZeroMemory(pDevice->bButtonStates, sizeof(pDevice->bButtonStates));
+		for(i = 0; i < usageLength; i++)
+		{
+			j = usage[i] - pButtonCaps->Range.UsageMin;
+			if(j < (ULONG)pDevice->NumberOfButtons)
+				pDevice->bButtonStates[j] = TRUE;
+		}
+	}
+
+	for(i = 0; i < pDevice->Caps.NumberInputValueCaps; i++)
+	{
+		if(!IN_REPORT(&pValueCaps[i], pReport))
+			continue;
+
+		CHECK(
+			HidP_GetUsageValue(
+				HidP_Input, pValueCaps[i].UsagePage, 0, pValueCaps[i].Range.UsageMin, &value, pDevice->pPreparsedData,
+				pReport, cbReport
+			) == HIDP_STATUS_SUCCESS );
+
+		// Each sample normalizes its own set of axes
+		if(g_dwAxisMapping == CAPTURE_AXES_BUFFERED)
+		{
+			switch(pValueCaps[i].Range.UsageMin)
+			{
+			case 0x30:	// X-axis
+				pDevice->lAxisX = (LONG)value - 128;
+				break;
+
+			case 0x31:	// Y-axis
+				pDevice->lAxisY = (LONG)value - 128;
+				break;
+
+			case 0x32:	// Z-axis
+				pDevice->lAxisZ = (LONG)value - 128;
+				break;
+
+			case 0x35:	// Rotate-Z
+				pDevice->lAxisRz = (LONG)value - 128;
+				break;
+
+			case 0x39:	// Hat Switch
+				pDevice->lHat = value;
+				break;
+			}
+		}
+		else
+		{
+			switch(pValueCaps[i].Range.UsageMin)
+			{
+			case 0x30:	// X-axis
+				pDevice->lAxisX = (LONG)(value - 32768) / 256;
+				break;
+
+			case 0x31:	// Y-axis
+				pDevice->lAxisY = (LONG)(value - 32768) / 256;
+				break;
+
+			case 0x33:
+				pDevice->lAxisZ = (LONG)(value - 32768) / 256;
+				break;
+
+			case 0x34:
+				pDevice->lAxisRz = (LONG)(value - 32768) / 256;
+				break;
+
+			case 0x39:	// Hat Switch
+				pDevice->lHat = value;
+				break;
+			}
+		}
+	}
+
+	return TRUE;
+
+Error:
+	return FALSE;
+}
+
+
+//
+// A CAPTURE_SESSION record. The counter restarts with Windows, so a
+// session's timestamps count from its own record, and handles of earlier
+// sessions are void.
+//
+
+void StartSession(const CAPTURE_RECORD_HEADER *pHeader, const BYTE *pData)
+{
+	CAPTURE_SESSION_INFO session;
+	UINT                 i;
+
+	if(pHeader->cbData < sizeof(session))
+	{
+		g_qwErrors++;
+		return;
+	}
+	CopyMemory(&session, pData, sizeof(session));
+
+	for(i = 0; i < g_NumberOfDevices; i++)
+		CloseDevice(&g_Devices[i]);
+	g_NumberOfDevices = 0;
+
+	g_qwFirstTimestamp = pHeader->qwTimestamp;
+	if(session.qwFrequency)
+		g_qwFrequency = session.qwFrequency;
+	g_dwAxisMapping = session.dwAxisMapping;
+}
+
+
+//
+// Output
+//
+// Rows are "time,device,event,button,x,y,z,rz,hat,buttons" where event is
+// "state" for every decoded report, or "press"/"release" for a button edge.
+//
+
+void WriteOutput(const char *pLine, DWORD cbLine)
+{
+	if(g_pOutput->cbUsed + cbLine > BLOCK_SIZE)
+	{
+		PushBlock(&g_WriteQueue, g_pOutput);
+		g_pOutput = PopBlock(&g_WriteFree);
+		g_pOutput->cbUsed = 0;
+	}
+	CopyMemory(g_pOutput->data + g_pOutput->cbUsed, pLine, cbLine);
+	g_pOutput->cbUsed += cbLine;
+}
+
+
+void WriteState(PDEVICE pDevice, double time)
+{
+	char line[MAX_LINE];
+	int  length, i;
+
+	length = sprintf_s(line, "%.6f,%016llX,state,,%ld,%ld,%ld,%ld,%ld,",
+		time, pDevice->qwDevice, pDevice->lAxisX, pDevice->lAxisY, pDevice->lAxisZ, pDevice->lAxisRz, pDevice->lHat);
+	for(i = 0; i < pDevice->NumberOfButtons && i < MAX_BUTTONS; i++)
+		line[length++] = pDevice->bButtonStates[i] ? '1' : '0';
+	line[length++] = '\n';
+	WriteOutput(line, length);
+}
+
+
+void WriteEdge(PDEVICE pDevice, double time, int button, BOOL bPressed)
+{
+	char line[MAX_LINE];
+	int  length;
+
+	length = sprintf_s(line, "%.6f,%016llX,%s,%d,,,,,,\n",
+		time, pDevice->qwDevice, bPressed ? "press" : "release", button);
+	WriteOutput(line, length);
+}
+
+
+//
+// A CAPTURE_REPORT record: a RAWHID holding dwCount reports
+//
+
+void DecodeReports(const CAPTURE_RECORD_HEADER *pHeader, const BYTE *pData)
+{
+	PDEVICE pDevice;
+	BOOL    bLastButtonStates[MAX_BUTTONS];
+	DWORD   dwSizeHid, dwCount, i;
+	double  time;
+	int     button;
+
+	pDevice = FindDevice(pHeader->qwDevice);
+	if(!pDevice || pHeader->cbData < FIELD_OFFSET(RAWHID, bRawData))
+	{
+		g_qwErrors++;
+		return;
+	}
+
+	CopyMemory(&dwSizeHid, pData, sizeof(DWORD));
+	CopyMemory(&dwCount, pData + sizeof(DWORD), sizeof(DWORD));
+	pData += FIELD_OFFSET(RAWHID, bRawData);
+
+	if(pHeader->cbData < FIELD_OFFSET(RAWHID, bRawData) + (ULONGLONG)dwSizeHid * dwCount)
+	{
+		g_qwErrors++;
+		return;
+	}
+
+	time = (double)(pHeader->qwTimestamp - g_qwFirstTimestamp) / g_qwFrequency;
+
+	for(i = 0; i < dwCount; i++)
+	{
+		CopyMemory(bLastButtonStates, pDevice->bButtonStates, sizeof(bLastButtonStates));
+		if(!DecodeReport(pDevice, (PCHAR)pData + i * dwSizeHid, dwSizeHid))
+		{
+			g_qwErrors++;
+			continue;
+		}
+		g_qwReports++;
+
+		for(button = 0; button < pDevice->NumberOfButtons && button < MAX_BUTTONS; button++)
+		{
+			if(pDevice->bButtonStates[button] != bLastButtonStates[button])
+				WriteEdge(pDevice, time, button + 1, pDevice->bButtonStates[button]);
+		}
+		WriteState(pDevice, time);
+	}
+}
+
+
+//
+// Pipeline stages
+//
+
+DWORD WINAPI ReadThread(LPVOID pParam)
+{
+	FILE                 *pFile = (FILE*)pParam;
+	CAPTURE_RECORD_HEADER header;
+	PBLOCK                pBlock;
+	DWORD                 cbRecord;
+
+	pBlock = PopBlock(&g_ReadFree);
+	pBlock->cbUsed = 0;
+
+	while(fread(&header, sizeof(header), 1, pFile) == 1)
+	{
+		cbRecord = sizeof(header) + header.cbData;
+		if(header.cbData > BLOCK_SIZE - sizeof(header))
+		{
+			fprintf(stderr, "Record of %lu bytes does not fit in a block, stopping\n", header.cbData);
+			break;
+		}
+
+		// Blocks only ever hold whole records
+		if(pBlock->cbUsed + cbRecord > BLOCK_SIZE)
+		{
+			PushBlock(&g_ReadQueue, pBlock);
+			pBlock = PopBlock(&g_ReadFree);
+			pBlock->cbUsed = 0;
+		}
+
+		CopyMemory(pBlock->data + pBlock->cbUsed, &header, sizeof(header));
+		if(fread(pBlock->data + pBlock->cbUsed + sizeof(header), 1, header.cbData, pFile) != header.cbData)
+		{
+			fprintf(stderr, "Capture is truncated\n");
+			break;
+		}
+		pBlock->cbUsed += cbRecord;
+	}
+
+	PushBlock(&g_ReadQueue, pBlock);
+	PushBlock(&g_ReadQueue, NULL);
+	return 0;
+}
+
+
+DWORD WINAPI WriteThread(LPVOID pParam)
+{
+	FILE  *pFile = (FILE*)pParam;
+	PBLOCK pBlock;
+
+	while((pBlock = PopBlock(&g_WriteQueue)) != NULL)
+	{
+		fwrite(pBlock->data, 1, pBlock->cbUsed, pFile);
+		PushBlock(&g_WriteFree, pBlock);
+	}
+	return 0;
+}
+
+
+void DecodeBlocks(void)
+{
+	CAPTURE_RECORD_HEADER header;
+	PBLOCK                pBlock;
+	DWORD                 offset;
+	const char           *pszColumns = "time,device,event,button,x,y,z,rz,hat,buttons\n";
+
+	g_pOutput = PopBlock(&g_WriteFree);
+	g_pOutput->cbUsed = 0;
+	WriteOutput(pszColumns, (DWORD)strlen(pszColumns));
+
+	while((pBlock = PopBlock(&g_ReadQueue)) != NULL)
+	{
+		for(offset = 0; offset < pBlock->cbUsed; offset += sizeof(header) + header.cbData)
+		{
+			CopyMemory(&header, pBlock->data + offset, sizeof(header));
+			if(!g_qwFirstTimestamp)
+				g_qwFirstTimestamp = header.qwTimestamp;
+
+			switch(header.dwType)
+			{
+			case CAPTURE_DEVICE:
+				if(!OpenDevice(header.qwDevice, pBlock->data + offset + sizeof(header), header.cbData))
+					fprintf(stderr, "Device %016llX: unable to parse its preparsed data\n", header.qwDevice);
+				break;
+
+			case CAPTURE_REPORT:
+				DecodeReports(&header, pBlock->data + offset + sizeof(header));
+				break;
+
+			case CAPTURE_REMOVAL:
+				RemoveDevice(header.qwDevice);
+				break;
+
+			case CAPTURE_SESSION:
+				StartSession(&header, pBlock->data + offset + sizeof(header));
+				break;
+
+			case CAPTURE_MISMATCH:
+				// Shadow verification logs describe the report that follows
+				fprintf(stderr, "%.*s", (int)header.cbData, pBlock->data + offset + sizeof(header));
+				break;
+			}
+		}
+		PushBlock(&g_ReadFree, pBlock);
+	}
+
+	PushBlock(&g_WriteQueue, g_pOutput);
+	PushBlock(&g_WriteQueue, NULL);
+}
+
+
+int main(int argc, char *argv[])
+{
+	CAPTURE_FILE_HEADER header;
+	LARGE_INTEGER       start, end, frequency;
+	FILE               *pInput, *pOutput;
+	HANDLE              hReader, hWriter;
+	double              seconds;
+
+	if(argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "Usage: RawInputDecode <capture file> [<output.csv>]\n");
+		return 1;
+	}
+
+	if(fopen_s(&pInput, argv[1], "rb") != 0)
+	{
+		fprintf(stderr, "Unable to open %s\n", argv[1]);
+		return 1;
+	}
+	if(fread(&header, sizeof(header), 1, pInput) != 1 || header.dwMagic != CAPTURE_MAGIC || header.dwVersion != CAPTURE_VERSION)
+	{
+		fprintf(stderr, "%s is not a Raw Input capture\n", argv[1]);
+		return 1;
+	}
+	g_qwFrequency = header.qwFrequency;
+
+	pOutput = stdout;
+	if(argc == 3 && fopen_s(&pOutput, argv[2], "wb") != 0)
+	{
+		fprintf(stderr, "Unable to create %s\n", argv[2]);
+		return 1;
+	}
+
+	if(!InitBlockQueue(&g_ReadQueue, FALSE) || !InitBlockQueue(&g_ReadFree, TRUE) ||
+		!InitBlockQueue(&g_WriteQueue, FALSE) || !InitBlockQueue(&g_WriteFree, TRUE))
+	{
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	//
+	// Read, decode and write concurrently
+	//
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	hReader = CreateThread(NULL, 0, ReadThread, pInput, 0, NULL);
+	hWriter = CreateThread(NULL, 0, WriteThread, pOutput, 0, NULL);
+	if(!hReader || !hWriter)
+	{
+		fprintf(stderr, "Unable to start the pipeline\n");
+		return 1;
+	}
+
+	DecodeBlocks();
+
+	WaitForSingleObject(hReader, INFINITE);
+	WaitForSingleObject(hWriter, INFINITE);
+	CloseHandle(hReader);
+	CloseHandle(hWriter);
+
+	QueryPerformanceCounter(&end);
+	seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+	fclose(pInput);
+	if(pOutput != stdout)
+		fclose(pOutput);
+
+	fprintf(stderr, "%llu reports from %u devices decoded in %.3f s (%.0f reports/s), %llu errors\n",
+		g_qwReports, g_NumberOfDevices, seconds, seconds > 0 ? g_qwReports / seconds : 0.0, g_qwErrors);
+
+	return g_qwErrors ? 2 : 0;
+}
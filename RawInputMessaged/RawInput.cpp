@@ -28,7 +28,10 @@
 
 static HWND g_hWnd;
 
-void ParseRawInput(PRAWINPUT pRawInput);
+void IngestRawInput(PRAWINPUT pRawInput, LONGLONG qwTimestamp, BOOL bMorePending);
+struct _DEVICE_CONTEXT *AcquireDeviceContext(HANDLE hDevice);
+void ReleaseDeviceContext(HANDLE hDevice);
+void CaptureDeviceRemoval(HANDLE hDevice);
 
 static const char *hex = "0123456789ABCDEF";
 
@@ -43,9 +46,12 @@ static LRESULT CALLBACK SDL_HelperWindowProc(HWND hWnd, UINT msg, WPARAM wParam,
 			switch (wParam) {
 			case GIDC_ARRIVAL:
 				sprintf_s(buf, "Device %08p: Added\n", hDevice);
+				AcquireDeviceContext(hDevice);
 				break;
 			case GIDC_REMOVAL:
 				sprintf_s(buf, "Device %08p: Removed\n", hDevice);
+				ReleaseDeviceContext(hDevice);
+				CaptureDeviceRemoval(hDevice);
 				break;
 			default:
 				return 0;
@@ -55,10 +61,12 @@ static LRESULT CALLBACK SDL_HelperWindowProc(HWND hWnd, UINT msg, WPARAM wParam,
 		return 0;
 		case WM_INPUT:
 		{
-			PRAWINPUT pRawInput;
-			UINT      bufferSize;
-			HANDLE    hHeap;
+			PRAWINPUT     pRawInput;
+			UINT          bufferSize;
+			HANDLE        hHeap;
+			LARGE_INTEGER now;
 
+			QueryPerformanceCounter(&now);
 			GetRawInputData((HRAWINPUT)lParam, RID_INPUT, NULL, &bufferSize, sizeof(RAWINPUTHEADER));
 
 			hHeap = GetProcessHeap();
@@ -78,177 +86,1625 @@ static LRESULT CALLBACK SDL_HelperWindowProc(HWND hWnd, UINT msg, WPARAM wParam,
 			*out++ = 0;
 			OutputDebugStringA(buf);
 			// &pRawInput->data.hid.bRawData[1] is the state packet that SDL's hidapi knows how to read already
-			ParseRawInput(pRawInput);
+			IngestRawInput(pRawInput, now.QuadPart, HIWORD(GetQueueStatus(QS_RAWINPUT)) & QS_RAWINPUT);
 
 			HeapFree(hHeap, 0, pRawInput);
+		}
+		return 0;
+	}
+	return DefWindowProc(hWnd, msg, wParam, lParam);
+}
+
+
+static WCHAR *SDL_HelperWindowClassName = TEXT("SDLHelperWindowInputCatcher");
+static WCHAR *SDL_HelperWindowName = TEXT("SDLHelperWindowInputMsgWindow");
+static ATOM SDL_HelperWindowClass = 0;
+static HWND SDL_HelperWindow;
+int SDL_HelperWindowCreate(void)
+{
+	HINSTANCE hInstance = GetModuleHandle(NULL);
+	WNDCLASS wce = {};
+
+	/* Make sure window isn't created twice. */
+	if (SDL_HelperWindow != NULL) {
+		return 0;
+	}
+
+	/* Create the class. */
+	wce.lpfnWndProc = SDL_HelperWindowProc;
+	wce.lpszClassName = (LPCWSTR)SDL_HelperWindowClassName;
+	wce.hInstance = hInstance;
+
+	/* Register the class. */
+	SDL_HelperWindowClass = RegisterClass(&wce);
+	if (SDL_HelperWindowClass == 0 && GetLastError() != ERROR_CLASS_ALREADY_EXISTS) {
+		assert(!"Unable to create Helper Window Class");
+		return -1;
+	}
+
+	/* Create the window. */
+	SDL_HelperWindow = CreateWindowEx(0, SDL_HelperWindowClassName,
+		SDL_HelperWindowName,
+		WS_OVERLAPPED, CW_USEDEFAULT,
+		CW_USEDEFAULT, CW_USEDEFAULT,
+		CW_USEDEFAULT, HWND_MESSAGE, NULL,
+		hInstance, NULL);
+	if (SDL_HelperWindow == NULL) {
+		UnregisterClass(SDL_HelperWindowClassName, hInstance);
+		assert(!"Unable to create Helper Window");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//
+// Global variables
+//
+
+HANDLE g_hLastDevice;		// device of the latest decoded report
+UINT   g_VerifySampleRate;	// see "Shadow verification"
+
+
+//
+// Usage filters
+//
+// Every subscriber declares up front which controls it reads, e.g.
+//
+//   static const INPUT_FILTER StickFilter = { FIELD_X | FIELD_Y, 4 };
+//
+// for the X/Y axes and buttons 1-4. The filters of all subscribers are merged
+// into g_FieldPlan, and ParseRawInputReport only extracts what the plan
+// contains; a device's value caps are reduced to the planned ones once per
+// plan change rather than filtered on every report.
+//
+
+#define FIELD_X			0x0001
+#define FIELD_Y			0x0002
+#define FIELD_Z			0x0004
+#define FIELD_RZ		0x0008
+#define FIELD_HAT		0x0010
+#define FIELD_ALL		(FIELD_X | FIELD_Y | FIELD_Z | FIELD_RZ | FIELD_HAT)
+
+typedef struct _INPUT_FILTER
+{
+	DWORD dwFields;			// FIELD_* of the values to extract
+	INT   NumberOfButtons;	// buttons 1 to NumberOfButtons are extracted
+} INPUT_FILTER, *PINPUT_FILTER;
+
+INPUT_FILTER g_FieldPlan;
+UINT         g_FieldPlanVersion;
+
+
+DWORD UsageField(USAGE usage)
+{
+	switch(usage)
+	{
+	case 0x30:	return FIELD_X;
+	case 0x31:	return FIELD_Y;
+	case 0x33:	return FIELD_Z;
+	case 0x34:	return FIELD_RZ;
+	case 0x39:	return FIELD_HAT;
+	}
+	return 0;
+}
+
+
+//
+// Input subscribers
+//
+// Consumers subscribe with a delivery policy instead of being woken up for
+// every report:
+//
+//   DELIVER_LATEST  one notification per burst, g_hLastDevice has the latest state
+//   DELIVER_EDGES   every button press and release is queued as an INPUT_EDGE,
+//                   with the device it came from; one notification per report
+//                   that changed a button
+//   DELIVER_EVERY   every report is queued as an INPUT_EVENT
+//
+// Queues are bounded, and edges or events that do not fit are counted in
+// dwOverflow.
+//
+// Edges and events only cover the subscriber's own filter; the fields of an
+// INPUT_EVENT outside of it are left undefined.
+//
+// Edge detection and event snapshots are only done while a subscriber with
+// the matching policy exists.
+//
+
+#define MAX_SUBSCRIBERS		8
+
+typedef enum _DELIVERY_POLICY
+{
+	DELIVER_LATEST,
+	DELIVER_EDGES,
+	DELIVER_EVERY
+} DELIVERY_POLICY;
+
+typedef struct _INPUT_EVENT
+{
+	HANDLE hDevice;
+	BOOL   bButtonStates[MAX_BUTTONS];
+	LONG   lAxisX;
+	LONG   lAxisY;
+	LONG   lAxisZ;
+	LONG   lAxisRz;
+	LONG   lHat;
+	LONGLONG qwTimestamp;		// QueryPerformanceCounter when the report arrived
+} INPUT_EVENT, *PINPUT_EVENT;
+
+typedef struct _INPUT_EDGE
+{
+	HANDLE   hDevice;
+	INT      Button;			// 1 to MAX_BUTTONS
+	BOOL     bPressed;
+	LONGLONG qwTimestamp;		// QueryPerformanceCounter when the report arrived
+} INPUT_EDGE, *PINPUT_EDGE;
+
+typedef struct _SUBSCRIBER *PSUBSCRIBER;
+typedef void (*PINPUT_NOTIFY)(PSUBSCRIBER pSubscriber);
+
+typedef struct _SUBSCRIBER
+{
+	DELIVERY_POLICY Policy;
+	INPUT_FILTER    Filter;
+	PINPUT_NOTIFY   pfnNotify;
+	BOOL            bPending;
+	PINPUT_EVENT    pQueue;			// DELIVER_EVERY
+	PINPUT_EDGE     pEdges;			// DELIVER_EDGES
+	UINT            queueLength;
+	UINT            queueHead;
+	UINT            queueCount;
+	DWORD           dwOverflow;
+} SUBSCRIBER;
+
+SUBSCRIBER g_Subscribers[MAX_SUBSCRIBERS];
+UINT       g_NumberOfSubscribers;
+DWORD      g_SubscribedPolicies;
+
+
+PSUBSCRIBER Subscribe(DELIVERY_POLICY Policy, const INPUT_FILTER *pFilter, PINPUT_NOTIFY pfnNotify, UINT queueLength)
+{
+	PSUBSCRIBER pSubscriber;
+
+	if(g_NumberOfSubscribers == MAX_SUBSCRIBERS)
+		return NULL;
+
+	pSubscriber = &g_Subscribers[g_NumberOfSubscribers];
+	ZeroMemory(pSubscriber, sizeof(*pSubscriber));
+	pSubscriber->Policy    = Policy;
+	pSubscriber->Filter    = *pFilter;
+	pSubscriber->pfnNotify = pfnNotify;
+	if(pSubscriber->Filter.NumberOfButtons > MAX_BUTTONS)
+		pSubscriber->Filter.NumberOfButtons = MAX_BUTTONS;
+
+	if(Policy == DELIVER_EVERY)
+	{
+		if(queueLength == 0)
+			return NULL;
+		pSubscriber->pQueue = (PINPUT_EVENT)HeapAlloc(GetProcessHeap(), 0, sizeof(INPUT_EVENT) * queueLength);
+		if(!pSubscriber->pQueue)
+			return NULL;
+		pSubscriber->queueLength = queueLength;
+	}
+	else if(Policy == DELIVER_EDGES)
+	{
+		if(queueLength == 0)
+			return NULL;
+		pSubscriber->pEdges = (PINPUT_EDGE)HeapAlloc(GetProcessHeap(), 0, sizeof(INPUT_EDGE) * queueLength);
+		if(!pSubscriber->pEdges)
+			return NULL;
+		pSubscriber->queueLength = queueLength;
+	}
+
+	g_NumberOfSubscribers++;
+	g_SubscribedPolicies |= 1 << Policy;
+
+	g_FieldPlan.dwFields |= pSubscriber->Filter.dwFields;
+	if(pSubscriber->Filter.NumberOfButtons > g_FieldPlan.NumberOfButtons)
+		g_FieldPlan.NumberOfButtons = pSubscriber->Filter.NumberOfButtons;
+	g_FieldPlanVersion++;
+
+	return pSubscriber;
+}
+
+
+BOOL PopInputEvent(PSUBSCRIBER pSubscriber, PINPUT_EVENT pEvent)
+{
+	if(pSubscriber->queueCount == 0)
+		return FALSE;
+
+	*pEvent = pSubscriber->pQueue[pSubscriber->queueHead];
+	pSubscriber->queueHead = (pSubscriber->queueHead + 1) % pSubscriber->queueLength;
+	pSubscriber->queueCount--;
+	return TRUE;
+}
+
+
+BOOL PopInputEdge(PSUBSCRIBER pSubscriber, PINPUT_EDGE pEdge)
+{
+	if(pSubscriber->queueCount == 0)
+		return FALSE;
+
+	*pEdge = pSubscriber->pEdges[pSubscriber->queueHead];
+	pSubscriber->queueHead = (pSubscriber->queueHead + 1) % pSubscriber->queueLength;
+	pSubscriber->queueCount--;
+	return TRUE;
+}
+
+
+//
+// Called at the end of a burst of reports
+//
+
+void FlushSubscribers(void)
+{
+	UINT i;
+
+	for(i = 0; i < g_NumberOfSubscribers; i++)
+	{
+		if(g_Subscribers[i].bPending)
+		{
+			g_Subscribers[i].bPending = FALSE;
+			g_Subscribers[i].pfnNotify(&g_Subscribers[i]);
+		}
+	}
+}
+
+
+//
+// Called after every report, bMorePending tells whether more raw input is
+// already queued. Subscribers are notified once a burst has been drained,
+// and under sustained input, which may never drain, at most
+// FLUSH_INTERVAL_MS after the first report they have not been told about.
+//
+
+#define FLUSH_INTERVAL_MS	16
+
+LONGLONG g_qwFlushDue;
+
+
+void FlushSubscribersAfterReport(BOOL bMorePending)
+{
+	LARGE_INTEGER now, frequency;
+
+	QueryPerformanceCounter(&now);
+	if(!g_qwFlushDue)
+	{
+		QueryPerformanceFrequency(&frequency);
+		g_qwFlushDue = now.QuadPart + frequency.QuadPart * FLUSH_INTERVAL_MS / 1000;
+	}
+
+	if(bMorePending && now.QuadPart < g_qwFlushDue)
+		return;
+
+	FlushSubscribers();
+	g_qwFlushDue = 0;
+}
+
+
+//
+// Input capture
+//
+// With "-capture <file>" every report is appended to a capture file along
+// with the preparsed data of the device that sent it, so the session can be
+// decoded offline by RawInputDecode, which shares this layout.
+//
+// A CAPTURE_FILE_HEADER is followed by records, each a CAPTURE_RECORD_HEADER
+// and cbData bytes of payload:
+//
+//   CAPTURE_DEVICE  the device's preparsed data, written before its first report
+//   CAPTURE_REPORT  the RAWHID of the report: dwSizeHid, dwCount and the raw bytes
+//   CAPTURE_REMOVAL no payload, the device was unplugged and its handle may be reused
+//   CAPTURE_MISMATCH text describing a shadow verification mismatch, see below
+//   CAPTURE_SESSION  a CAPTURE_SESSION_INFO, written first by every session
+//
+// Timestamps count from the CAPTURE_SESSION record of their session, since
+// the counter restarts with Windows and mismatch logs collect sessions of
+// several boots. The session also says which sample's axis normalization
+// the decoded values follow.
+//
+
+#define CAPTURE_MAGIC		0x50414352	// "RCAP"
+#define CAPTURE_VERSION		1
+#define CAPTURE_DEVICE		1
+#define CAPTURE_REPORT		2
+#define CAPTURE_REMOVAL		3
+#define CAPTURE_MISMATCH	4
+#define CAPTURE_SESSION		5
+
+typedef struct _CAPTURE_FILE_HEADER
+{
+	DWORD     dwMagic;
+	DWORD     dwVersion;
+	ULONGLONG qwFrequency;		// QueryPerformanceFrequency of the timestamps
+} CAPTURE_FILE_HEADER;
+
+typedef struct _CAPTURE_RECORD_HEADER
+{
+	DWORD     dwType;
+	DWORD     cbData;
+	ULONGLONG qwDevice;			// hDevice in the capturing session
+	ULONGLONG qwTimestamp;		// QueryPerformanceCounter when the record was written
+} CAPTURE_RECORD_HEADER;
+
+// Payload of CAPTURE_SESSION
+typedef struct _CAPTURE_SESSION_INFO
+{
+	ULONGLONG qwFrequency;		// QueryPerformanceFrequency of the session's timestamps
+	DWORD     dwAxisMapping;	// CAPTURE_AXES_*
+	DWORD     dwReserved;
+} CAPTURE_SESSION_INFO;
+
+#define CAPTURE_AXES_MESSAGED	0	// Z 0x33, Rz 0x34, (value - 32768) / 256
+#define CAPTURE_AXES_BUFFERED	1	// Z 0x32, Rz 0x35, value - 128
+
+FILE *g_pCaptureFile;
+
+
+void WriteCaptureHeader(FILE *pFile)
+{
+	CAPTURE_FILE_HEADER header;
+	LARGE_INTEGER       frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	header.dwMagic     = CAPTURE_MAGIC;
+	header.dwVersion   = CAPTURE_VERSION;
+	header.qwFrequency = frequency.QuadPart;
+	fwrite(&header, sizeof(header), 1, pFile);
+}
+
+
+void WriteCaptureRecord(FILE *pFile, DWORD dwType, HANDLE hDevice, const void *pData, DWORD cbData)
+{
+	CAPTURE_RECORD_HEADER header;
+	LARGE_INTEGER         now;
+
+	if(!pFile)
+		return;
+
+	QueryPerformanceCounter(&now);
+	header.dwType      = dwType;
+	header.cbData      = cbData;
+	header.qwDevice    = (ULONGLONG)(ULONG_PTR)hDevice;
+	header.qwTimestamp = now.QuadPart;
+	fwrite(&header, sizeof(header), 1, pFile);
+	fwrite(pData, 1, cbData, pFile);
+}
+
+
+void WriteCaptureSession(FILE *pFile)
+{
+	CAPTURE_SESSION_INFO session;
+	LARGE_INTEGER        frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	ZeroMemory(&session, sizeof(session));
+	session.qwFrequency   = frequency.QuadPart;
+	session.dwAxisMapping = CAPTURE_AXES_MESSAGED;
+	WriteCaptureRecord(pFile, CAPTURE_SESSION, NULL, &session, sizeof(session));
+}
+
+
+BOOL OpenCaptureFile(const char *pszPath)
+{
+	if(fopen_s(&g_pCaptureFile, pszPath, "wb") != 0)
+		return FALSE;
+
+	WriteCaptureHeader(g_pCaptureFile);
+	WriteCaptureSession(g_pCaptureFile);
+	return TRUE;
+}
+
+
+void CaptureRawInput(PRAWINPUT pRawInput)
+{
+	WriteCaptureRecord(g_pCaptureFile, CAPTURE_REPORT, pRawInput->header.hDevice, &pRawInput->data.hid,
+		FIELD_OFFSET(RAWHID, bRawData) + pRawInput->data.hid.dwSizeHid * pRawInput->data.hid.dwCount);
+}
+
+
+void CaptureDeviceRemoval(HANDLE hDevice)
+{
+	WriteCaptureRecord(g_pCaptureFile, CAPTURE_REMOVAL, hDevice, NULL, 0);
+}
+
+
+//
+// Per-device decode context: the preparsed data and input caps that have to
+// be fetched from a device before any of its reports can be decoded, and the
+// state decoded from its latest report.
+//
+// All of it lives in a single heap block per device, sized from HIDP_CAPS:
+//
+//   [preparsed data][button caps][value caps][value plan][verify data][verify values]
+//
+// so a device's metadata is contiguous and goes away with one HeapFree. The
+// verify data and values are only reserved while shadow verification is
+// enabled.
+//
+
+#define ARENA_ALIGN(cb)		(((cb) + 7) & ~7)
+
+// Devices with several input reports prefix each with its report ID, and
+// every cap belongs to one of them; report ID 0 means the device has only one
+#define IN_REPORT(pCaps, pRawInput)	(!(pCaps)->ReportID || (pCaps)->ReportID == (pRawInput)->data.hid.bRawData[0])
+
+typedef struct _DEVICE_CONTEXT
+{
+	HANDLE               hDevice;
+	UINT                 cbArena;
+	PHIDP_PREPARSED_DATA pPreparsedData;		// start of the arena
+	UINT                 cbPreparsedData;
+	HIDP_CAPS            Caps;
+	PHIDP_BUTTON_CAPS    pButtonCaps;
+	PHIDP_VALUE_CAPS     pValueCaps;
+	INT                  NumberOfButtons;
+	PUSHORT              pValuePlan;			// indices into pValueCaps
+	USHORT               NumberOfPlannedValues;
+	INT                  NumberOfPlannedButtons;
+	UINT                 PlanVersion;
+	PHIDP_DATA           pVerifyData;
+	ULONG                VerifyDataLength;
+	PULONG               pVerifyValues;		// raw value per value cap, as last decoded
+	BOOL                 bVerifyLogged;		// preparsed data is in the mismatch log
+
+	BOOL                 bButtonStates[MAX_BUTTONS];
+	BOOL                 bLastButtonStates[MAX_BUTTONS];	// as of the last edge
+	LONG                 lAxisX;
+	LONG                 lAxisY;
+	LONG                 lAxisZ;
+	LONG                 lAxisRz;
+	LONG                 lHat;
+} DEVICE_CONTEXT, *PDEVICE_CONTEXT;
+
+
+UINT g_DeviceArenaBytes;
+
+
+void CloseDeviceContext(PDEVICE_CONTEXT pContext)
+{
+	HANDLE hHeap = GetProcessHeap();
+
+	g_DeviceArenaBytes -= pContext->cbArena;
+	pContext->cbArena     = 0;
+	pContext->pButtonCaps = NULL;
+	pContext->pValueCaps  = NULL;
+	pContext->pValuePlan  = NULL;
+	pContext->pVerifyData = NULL;
+	pContext->pVerifyValues = NULL;
+	SAFE_FREE(pContext->pPreparsedData);
+}
+
+
+//
+// Reduce the device's value caps to the ones the current field plan needs
+//
+
+void PlanDeviceContext(PDEVICE_CONTEXT pContext)
+{
+	USHORT i;
+
+	pContext->NumberOfPlannedButtons = pContext->NumberOfButtons;
+	if(pContext->NumberOfPlannedButtons > g_FieldPlan.NumberOfButtons)
+		pContext->NumberOfPlannedButtons = g_FieldPlan.NumberOfButtons;
 
-			InvalidateRect(g_hWnd, NULL, TRUE);
-			UpdateWindow(g_hWnd);
+	pContext->NumberOfPlannedValues = 0;
+	for(i = 0; i < pContext->Caps.NumberInputValueCaps; i++)
+	{
+		if(g_FieldPlan.dwFields & UsageField(pContext->pValueCaps[i].Range.UsageMin))
+			pContext->pValuePlan[pContext->NumberOfPlannedValues++] = i;
+	}
+	pContext->PlanVersion = g_FieldPlanVersion;
+}
+
+
+BOOL OpenDeviceContext(HANDLE hDevice, PDEVICE_CONTEXT pContext, const void *pPreparsedData, UINT cbPreparsedData)
+{
+	PBYTE  pArena;
+	USHORT capsLength;
+	UINT   bufferSize, cbButtonCaps, cbValueCaps, cbValuePlan, cbVerifyData, cbVerifyValues, cbArena;
+	HANDLE hHeap;
+
+	ZeroMemory(pContext, sizeof(*pContext));
+	pContext->hDevice = hDevice;
+	hHeap             = GetProcessHeap();
+
+	//
+	// Get the preparsed data block, virtual devices bring their own
+	//
+
+	if(pPreparsedData)
+	{
+		bufferSize = cbPreparsedData;
+		CHECK( pContext->pPreparsedData = (PHIDP_PREPARSED_DATA)HeapAlloc(hHeap, 0, bufferSize) );
+		CopyMemory(pContext->pPreparsedData, pPreparsedData, bufferSize);
+	}
+	else
+	{
+		CHECK( GetRawInputDeviceInfo(hDevice, RIDI_PREPARSEDDATA, NULL, &bufferSize) == 0 );
+		CHECK( pContext->pPreparsedData = (PHIDP_PREPARSED_DATA)HeapAlloc(hHeap, 0, bufferSize) );
+		CHECK( (int)GetRawInputDeviceInfo(hDevice, RIDI_PREPARSEDDATA, pContext->pPreparsedData, &bufferSize) >= 0 );
+	}
+
+	//
+	// Get the joystick's capabilities and grow the block into the arena.
+	// Preparsed data holds no pointers into itself, so it may move.
+	//
+
+	CHECK( HidP_GetCaps(pContext->pPreparsedData, &pContext->Caps) == HIDP_STATUS_SUCCESS )
+
+	if(g_VerifySampleRate)
+		pContext->VerifyDataLength = HidP_MaxDataListLength(HidP_Input, pContext->pPreparsedData);
+
+	cbButtonCaps = ARENA_ALIGN(sizeof(HIDP_BUTTON_CAPS) * pContext->Caps.NumberInputButtonCaps);
+	cbValueCaps  = ARENA_ALIGN(sizeof(HIDP_VALUE_CAPS) * pContext->Caps.NumberInputValueCaps);
+	cbValuePlan  = ARENA_ALIGN(sizeof(USHORT) * pContext->Caps.NumberInputValueCaps);
+	cbVerifyData = ARENA_ALIGN(sizeof(HIDP_DATA) * pContext->VerifyDataLength);
+	cbVerifyValues = g_VerifySampleRate ? ARENA_ALIGN(sizeof(ULONG) * pContext->Caps.NumberInputValueCaps) : 0;
+	cbArena      = ARENA_ALIGN(bufferSize) + cbButtonCaps + cbValueCaps + cbValuePlan + cbVerifyData + cbVerifyValues;
+
+	CHECK( pArena = (PBYTE)HeapReAlloc(hHeap, 0, pContext->pPreparsedData, cbArena) );
+	pContext->pPreparsedData  = (PHIDP_PREPARSED_DATA)pArena;
+	pContext->cbPreparsedData = bufferSize;
+	pContext->cbArena         = cbArena;
+	g_DeviceArenaBytes       += cbArena;
+
+	pArena += ARENA_ALIGN(bufferSize);
+	pContext->pButtonCaps = (PHIDP_BUTTON_CAPS)pArena;
+	pArena += cbButtonCaps;
+	pContext->pValueCaps  = (PHIDP_VALUE_CAPS)pArena;
+	pArena += cbValueCaps;
+	pContext->pValuePlan  = (PUSHORT)pArena;
+	pArena += cbValuePlan;
+	if(pContext->VerifyDataLength)
+		pContext->pVerifyData = (PHIDP_DATA)pArena;
+	pArena += cbVerifyData;
+	if(cbVerifyValues)
+		pContext->pVerifyValues = (PULONG)pArena;
+
+	// Button caps
+	capsLength = pContext->Caps.NumberInputButtonCaps;
+	CHECK( HidP_GetButtonCaps(HidP_Input, pContext->pButtonCaps, &capsLength, pContext->pPreparsedData) == HIDP_STATUS_SUCCESS )
+
+	// Pedals and the like have no buttons, and no more than MAX_BUTTONS are decoded
+	if(pContext->Caps.NumberInputButtonCaps)
+	{
+		pContext->NumberOfButtons = 1;
+		if(pContext->pButtonCaps->IsRange)
+			pContext->NumberOfButtons = pContext->pButtonCaps->Range.UsageMax - pContext->pButtonCaps->Range.UsageMin + 1;
+	}
+	if(pContext->NumberOfButtons < 0)
+		pContext->NumberOfButtons = 0;
+	if(pContext->NumberOfButtons > MAX_BUTTONS)
+		pContext->NumberOfButtons = MAX_BUTTONS;
+
+	// Value caps
+	capsLength = pContext->Caps.NumberInputValueCaps;
+	CHECK( HidP_GetValueCaps(HidP_Input, pContext->pValueCaps, &capsLength, pContext->pPreparsedData) == HIDP_STATUS_SUCCESS )
+	PlanDeviceContext(pContext);
+
+	WriteCaptureRecord(g_pCaptureFile, CAPTURE_DEVICE, hDevice, pContext->pPreparsedData, bufferSize);
+
+	return TRUE;
+
+Error:
+	CloseDeviceContext(pContext);
+	return FALSE;
+}
+
+
+//
+// Device context cache
+//
+// A device's preparsed data and caps do not change while it is attached, so
+// its context is built on arrival or first use and released on GIDC_REMOVAL,
+// before another device can reuse the handle. Entries whose handle no longer
+// resolves are also pruned when the table fills up. The cache only lives as
+// long as the process, so building the contexts at startup costs what it
+// always did.
+//
+
+#define MAX_DEVICES		32
+
+DEVICE_CONTEXT g_Devices[MAX_DEVICES];
+UINT           g_NumberOfDevices;
+
+
+void LogDeviceArenas(PDEVICE_CONTEXT pContext)
+{
+	char buf[256];
+
+	if(pContext)
+	{
+		sprintf_s(buf, "Device %08p: %u byte arena (%u button caps, %u value caps)\n",
+			pContext->hDevice, pContext->cbArena, pContext->Caps.NumberInputButtonCaps, pContext->Caps.NumberInputValueCaps);
+		OutputDebugStringA(buf);
+	}
+	sprintf_s(buf, "Device arenas: %u bytes for %u devices\n", g_DeviceArenaBytes, g_NumberOfDevices);
+	OutputDebugStringA(buf);
+}
+
+
+PDEVICE_CONTEXT FindDeviceContext(HANDLE hDevice)
+{
+	UINT i;
+
+	for(i = 0; i < g_NumberOfDevices; i++)
+	{
+		if(g_Devices[i].hDevice == hDevice)
+			return &g_Devices[i];
+	}
+	return NULL;
+}
+
+
+void ReleaseDeviceContext(HANDLE hDevice)
+{
+	PDEVICE_CONTEXT pContext;
+
+	pContext = FindDeviceContext(hDevice);
+	if(!pContext)
+		return;
+
+	CloseDeviceContext(pContext);
+	*pContext = g_Devices[--g_NumberOfDevices];
+	LogDeviceArenas(NULL);
+}
+
+
+void PruneDeviceContexts(void)
+{
+	UINT i, bufferSize;
+
+	for(i = 0; i < g_NumberOfDevices; )
+	{
+		if(GetRawInputDeviceInfo(g_Devices[i].hDevice, RIDI_PREPARSEDDATA, NULL, &bufferSize) != 0)
+			ReleaseDeviceContext(g_Devices[i].hDevice);
+		else
+			i++;
+	}
+}
+
+
+PDEVICE_CONTEXT AcquireDeviceContext(HANDLE hDevice)
+{
+	PDEVICE_CONTEXT pContext;
+
+	pContext = FindDeviceContext(hDevice);
+	if(pContext)
+		return pContext;
+
+	if(g_NumberOfDevices == MAX_DEVICES)
+	{
+		PruneDeviceContexts();
+		if(g_NumberOfDevices == MAX_DEVICES)
+			return NULL;
+	}
+
+	pContext = &g_Devices[g_NumberOfDevices];
+	if(!OpenDeviceContext(hDevice, pContext, NULL, 0))
+		return NULL;
+
+	g_NumberOfDevices++;
+	LogDeviceArenas(pContext);
+	return pContext;
+}
+
+
+//
+// Virtual devices of the load generator have no preparsed data to fetch
+//
+
+PDEVICE_CONTEXT AddVirtualDeviceContext(HANDLE hDevice, const void *pPreparsedData, UINT cbPreparsedData)
+{
+	PDEVICE_CONTEXT pContext;
+
+	ReleaseDeviceContext(hDevice);
+	if(g_NumberOfDevices == MAX_DEVICES)
+		return NULL;
+
+	pContext = &g_Devices[g_NumberOfDevices];
+	if(!OpenDeviceContext(hDevice, pContext, pPreparsedData, cbPreparsedData))
+		return NULL;
+
+	g_NumberOfDevices++;
+	LogDeviceArenas(pContext);
+	return pContext;
+}
+
+
+//
+// Shadow verification
+//
+// One in g_VerifySampleRate successfully decoded reports is decoded a second
+// time through HidP_GetData and compared field by field with what
+// ParseRawInputReport produced, so a decoder that gets a bit offset wrong
+// shows up instead of silently corrupting input.
+// 0 disables the check; it is set with "-verify N" on the command line.
+//
+// Mismatches are appended to a log in the capture file format, so they
+// outlive the session and RawInputDecode can decode the offending reports:
+// the device's preparsed data before its first mismatch, then per
+// mismatching report a CAPTURE_MISMATCH record describing every field that
+// differs, followed by the report.
+// The log is "-mismatchlog <file>", by default RawInputVerify.rcap in the
+// temp directory, and is only created once something mismatches.
+//
+
+#define MAX_VERIFY_FIELDS	768		// characters of mismatching field descriptions per report
+
+UINT  g_VerifyCounter;
+UINT  g_VerifyMismatches;
+FILE *g_pVerifyLog;
+char  g_szVerifyLog[MAX_PATH];
+
+
+BOOL OpenVerifyLog(void)
+{
+	if(g_pVerifyLog)
+		return TRUE;
+	if(fopen_s(&g_pVerifyLog, g_szVerifyLog, "ab") != 0)
+		return FALSE;
+
+	// Sessions append to the same log, only a new one gets a header, and
+	// every session starts with its own timestamp base
+	_fseeki64(g_pVerifyLog, 0, SEEK_END);
+	if(_ftelli64(g_pVerifyLog) == 0)
+		WriteCaptureHeader(g_pVerifyLog);
+	WriteCaptureSession(g_pVerifyLog);
+	return TRUE;
+}
+
+
+void LogVerifyMismatch(PDEVICE_CONTEXT pContext, PRAWINPUT pRawInput, UINT fieldCount, const char *pszFields)
+{
+	RID_DEVICE_INFO info;
+	UINT            size;
+	char            buf[MAX_VERIFY_FIELDS + 256];
+	char           *out;
+
+	g_VerifyMismatches++;
+
+	ZeroMemory(&info, sizeof(info));
+	info.cbSize = size = sizeof(info);
+	GetRawInputDeviceInfo(pContext->hDevice, RIDI_DEVICEINFO, &info, &size);
+
+	_snprintf_s(buf, sizeof(buf), _TRUNCATE, "Verify mismatch #%u, device %08p (VID %04X PID %04X, usage %02X:%02X, %u byte reports), %u fields: %s\n",
+		g_VerifyMismatches, pContext->hDevice, info.hid.dwVendorId, info.hid.dwProductId,
+		pContext->Caps.UsagePage, pContext->Caps.Usage, pContext->Caps.InputReportByteLength, fieldCount, pszFields);
+	OutputDebugStringA(buf);
+
+	if(OpenVerifyLog())
+	{
+		if(!pContext->bVerifyLogged)
+		{
+			WriteCaptureRecord(g_pVerifyLog, CAPTURE_DEVICE, pContext->hDevice, pContext->pPreparsedData, pContext->cbPreparsedData);
+			pContext->bVerifyLogged = TRUE;
+		}
+		WriteCaptureRecord(g_pVerifyLog, CAPTURE_MISMATCH, pContext->hDevice, buf, (DWORD)strlen(buf));
+		WriteCaptureRecord(g_pVerifyLog, CAPTURE_REPORT, pContext->hDevice, &pRawInput->data.hid,
+			FIELD_OFFSET(RAWHID, bRawData) + pRawInput->data.hid.dwSizeHid * pRawInput->data.hid.dwCount);
+		fflush(g_pVerifyLog);
+	}
+
+	strcpy_s(buf, sizeof(buf), "Report: ");
+	out = buf + strlen(buf);
+	for (unsigned int ii = 0; ii < pRawInput->data.hid.dwSizeHid && out + 4 < buf + sizeof(buf); ii++) {
+		unsigned char byte = pRawInput->data.hid.bRawData[ii];
+		sprintf_s(out, 3, "%02X", byte);
+		out += 2;
+	}
+	*out++ = '\n';
+	*out++ = 0;
+	OutputDebugStringA(buf);
+}
+
+
+//
+// Appends the description of a mismatching field, cut short if there are
+// too many to describe
+//
+
+void AddVerifyField(char *pszFields, UINT *pFieldCount, const char *pszField)
+{
+	if (*pFieldCount)
+		strncat_s(pszFields, MAX_VERIFY_FIELDS, "; ", _TRUNCATE);
+	strncat_s(pszFields, MAX_VERIFY_FIELDS, pszField, _TRUNCATE);
+	(*pFieldCount)++;
+}
+
+
+void VerifyRawInputReport(PDEVICE_CONTEXT pContext, PRAWINPUT pRawInput)
+{
+	PHIDP_DATA        pData;
+	PHIDP_BUTTON_CAPS pButtonCaps;
+	PHIDP_VALUE_CAPS  pValueCaps;
+	PULONG            pValues;
+	BOOL              bReference[MAX_BUTTONS];
+	ULONG             dataLength, i, j, k;
+	USHORT            indexMin, indexMax;
+	UINT              fieldCount;
+	char              field[128];
+	char              fields[MAX_VERIFY_FIELDS];
+
+	pData   = pContext->pVerifyData;
+	pValues = pContext->pVerifyValues;
+	if (!pData)
+		return;
+
+	pButtonCaps = pContext->pButtonCaps;
+	pValueCaps  = pContext->pValueCaps;
+	dataLength  = pContext->VerifyDataLength;
+	fieldCount  = 0;
+	fields[0]   = 0;
+
+	if (HidP_GetData(HidP_Input, pData, &dataLength, pContext->pPreparsedData,
+		(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid) != HIDP_STATUS_SUCCESS)
+	{
+		LogVerifyMismatch(pContext, pRawInput, 1, "HidP_GetData failed");
+		return;
+	}
+
+	//
+	// Buttons: the data list only holds the ones that are down
+	//
+
+	if (pContext->NumberOfPlannedButtons > 0 && IN_REPORT(pButtonCaps, pRawInput))
+	{
+		ZeroMemory(bReference, sizeof(bReference));
+		indexMin = pButtonCaps->Range.DataIndexMin;
+		indexMax = pButtonCaps->IsRange ? pButtonCaps->Range.DataIndexMax : indexMin;
+
+		for (j = 0; j < dataLength; j++)
+		{
+			if (pData[j].DataIndex >= indexMin && pData[j].DataIndex <= indexMax && pData[j].DataIndex - indexMin < MAX_BUTTONS)
+				bReference[pData[j].DataIndex - indexMin] = pData[j].On;
+		}
+
+		for (i = 0; i < (ULONG)pContext->NumberOfPlannedButtons; i++)
+		{
+			if (!pContext->bButtonStates[i] != !bReference[i])
+			{
+				sprintf_s(field, "button %u: fast %d, reference %d", i + 1, !!pContext->bButtonStates[i], !!bReference[i]);
+				AddVerifyField(fields, &fieldCount, field);
+			}
+		}
+	}
+
+	//
+	// Values: compare the raw, unscaled value of every planned value cap
+	//
+
+	for (k = 0; k < pContext->NumberOfPlannedValues; k++)
+	{
+		i = pContext->pValuePlan[k];
+		if (!IN_REPORT(&pValueCaps[i], pRawInput))
+			continue;
+
+		for (j = 0; j < dataLength; j++)
+		{
+			if (pData[j].DataIndex == pValueCaps[i].Range.DataIndexMin)
+				break;
+		}
+
+		if (j == dataLength)
+		{
+			sprintf_s(field, "usage %02X:%02X: fast %lu, reference missing", pValueCaps[i].UsagePage, pValueCaps[i].Range.UsageMin, pValues[i]);
+			AddVerifyField(fields, &fieldCount, field);
+		}
+		else if (pData[j].RawValue != pValues[i])
+		{
+			sprintf_s(field, "usage %02X:%02X: fast %lu, reference %lu", pValueCaps[i].UsagePage, pValueCaps[i].Range.UsageMin, pValues[i], pData[j].RawValue);
+			AddVerifyField(fields, &fieldCount, field);
+		}
+	}
+
+	// One record per mismatching report, however many of its fields differ
+	if (fieldCount)
+		LogVerifyMismatch(pContext, pRawInput, fieldCount, fields);
+}
+
+
+BOOL ParseRawInputReport(PDEVICE_CONTEXT pContext, PRAWINPUT pRawInput)
+{
+	PHIDP_PREPARSED_DATA pPreparsedData;
+	PHIDP_BUTTON_CAPS    pButtonCaps;
+	PHIDP_VALUE_CAPS     pValueCaps;
+	USAGE                usage[MAX_BUTTONS];
+	ULONG                i, j, usageLength, value;
+
+	pPreparsedData = pContext->pPreparsedData;
+	pButtonCaps    = pContext->pButtonCaps;
+	pValueCaps     = pContext->pValueCaps;
+
+	if(pContext->PlanVersion != g_FieldPlanVersion)
+		PlanDeviceContext(pContext);
+
+	//
+	// Get the pressed buttons. Controls that are not in this report keep the
+	// state their own report last set.
+	//
+
+	if(pContext->NumberOfPlannedButtons > 0 && IN_REPORT(pButtonCaps, pRawInput))
+	{
+		usageLength = pContext->NumberOfButtons;
+		CHECK(
+			HidP_GetUsages(
+				HidP_Input, pButtonCaps->UsagePage, 0, usage, &usageLength, pPreparsedData,
+				(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid
+			) == HIDP_STATUS_SUCCESS );
+
+		ZeroMemory(pContext->bButtonStates, sizeof(pContext->bButtonStates));
+		for(i = 0; i < usageLength; i++)
+		{
+			j = usage[i] - pButtonCaps->Range.UsageMin;
+			if(j < (ULONG)pContext->NumberOfPlannedButtons)
+				pContext->bButtonStates[j] = TRUE;
+		}
+	}
+
+	//
+	// Get the state of the planned discrete-valued-controls
+	//
+
+	for(j = 0; j < pContext->NumberOfPlannedValues; j++)
+	{
+		i = pContext->pValuePlan[j];
+		if(!IN_REPORT(&pValueCaps[i], pRawInput))
+			continue;
+
+		CHECK(
+			HidP_GetUsageValue(
+				HidP_Input, pValueCaps[i].UsagePage, 0, pValueCaps[i].Range.UsageMin, &value, pPreparsedData,
+				(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid
+			) == HIDP_STATUS_SUCCESS );
+
+		if(pContext->pVerifyValues)
+			pContext->pVerifyValues[i] = value;
+
+		switch(pValueCaps[i].Range.UsageMin)
+		{
+		case 0x30:	// X-axis
+			pContext->lAxisX = (LONG)(value - 32768) / 256;
+			break;
+
+		case 0x31:	// Y-axis
+			pContext->lAxisY = (LONG)(value - 32768) / 256;
+			break;
+
+		case 0x33:
+			pContext->lAxisZ = (LONG)(value - 32768) / 256;
+			break;
+
+		case 0x34:
+			pContext->lAxisRz = (LONG)(value - 32768) / 256;
+			break;
+
+		case 0x39:	// Hat Switch
+			pContext->lHat = value;
+			break;
 		}
-		return 0;
 	}
-	return DefWindowProc(hWnd, msg, wParam, lParam);
+
+	if(g_VerifySampleRate && ++g_VerifyCounter >= g_VerifySampleRate)
+	{
+		g_VerifyCounter = 0;
+		VerifyRawInputReport(pContext, pRawInput);
+	}
+
+	return TRUE;
+
+Error:
+	return FALSE;
 }
 
 
-static WCHAR *SDL_HelperWindowClassName = TEXT("SDLHelperWindowInputCatcher");
-static WCHAR *SDL_HelperWindowName = TEXT("SDLHelperWindowInputMsgWindow");
-static ATOM SDL_HelperWindowClass = 0;
-static HWND SDL_HelperWindow;
-int SDL_HelperWindowCreate(void)
-{
-	HINSTANCE hInstance = GetModuleHandle(NULL);
-	WNDCLASS wce = {};
+//
+// Called once for every successfully decoded report. Edges are detected
+// against the same device's previous buttons, and DELIVER_LATEST
+// notifications read the state of the device in g_hLastDevice.
+//
 
-	/* Make sure window isn't created twice. */
-	if (SDL_HelperWindow != NULL) {
-		return 0;
+void PublishInput(PDEVICE_CONTEXT pContext, LONGLONG qwTimestamp)
+{
+	PSUBSCRIBER  pSubscriber;
+	PINPUT_EVENT pEvent;
+	PINPUT_EDGE  pEdge;
+	INT          firstEdge, button;
+	UINT         i;
+
+	g_hLastDevice = pContext->hDevice;
+
+	// Lowest button that changed, edge subscribers whose buttons all lie below
+	// it are skipped with one comparison
+	firstEdge = MAX_BUTTONS;
+	if(g_SubscribedPolicies & (1 << DELIVER_EDGES))
+	{
+		for(firstEdge = 0; firstEdge < pContext->NumberOfPlannedButtons; firstEdge++)
+		{
+			if(pContext->bLastButtonStates[firstEdge] != pContext->bButtonStates[firstEdge])
+				break;
+		}
+		if(firstEdge == pContext->NumberOfPlannedButtons)
+			firstEdge = MAX_BUTTONS;
 	}
 
-	/* Create the class. */
-	wce.lpfnWndProc = SDL_HelperWindowProc;
-	wce.lpszClassName = (LPCWSTR)SDL_HelperWindowClassName;
-	wce.hInstance = hInstance;
+	for(i = 0; i < g_NumberOfSubscribers; i++)
+	{
+		pSubscriber = &g_Subscribers[i];
 
-	/* Register the class. */
-	SDL_HelperWindowClass = RegisterClass(&wce);
-	if (SDL_HelperWindowClass == 0 && GetLastError() != ERROR_CLASS_ALREADY_EXISTS) {
-		assert(!"Unable to create Helper Window Class");
-		return -1;
-	}
+		switch(pSubscriber->Policy)
+		{
+		case DELIVER_LATEST:
+			pSubscriber->bPending = TRUE;
+			break;
 
-	/* Create the window. */
-	SDL_HelperWindow = CreateWindowEx(0, SDL_HelperWindowClassName,
-		SDL_HelperWindowName,
-		WS_OVERLAPPED, CW_USEDEFAULT,
-		CW_USEDEFAULT, CW_USEDEFAULT,
-		CW_USEDEFAULT, HWND_MESSAGE, NULL,
-		hInstance, NULL);
-	if (SDL_HelperWindow == NULL) {
-		UnregisterClass(SDL_HelperWindowClassName, hInstance);
-		assert(!"Unable to create Helper Window");
-		return -1;
+		case DELIVER_EDGES:
+			if(firstEdge >= pSubscriber->Filter.NumberOfButtons)
+				break;
+			for(button = firstEdge; button < pSubscriber->Filter.NumberOfButtons && button < pContext->NumberOfPlannedButtons; button++)
+			{
+				if(pContext->bLastButtonStates[button] == pContext->bButtonStates[button])
+					continue;
+				if(pSubscriber->queueCount == pSubscriber->queueLength)
+				{
+					pSubscriber->dwOverflow++;
+					continue;
+				}
+				pEdge = &pSubscriber->pEdges[(pSubscriber->queueHead + pSubscriber->queueCount) % pSubscriber->queueLength];
+				pEdge->hDevice     = pContext->hDevice;
+				pEdge->Button      = button + 1;
+				pEdge->bPressed    = pContext->bButtonStates[button];
+				pEdge->qwTimestamp = qwTimestamp;
+				pSubscriber->queueCount++;
+			}
+			pSubscriber->pfnNotify(pSubscriber);
+			break;
+
+		case DELIVER_EVERY:
+			if(pSubscriber->queueCount == pSubscriber->queueLength)
+			{
+				pSubscriber->dwOverflow++;
+				break;
+			}
+			pEvent = &pSubscriber->pQueue[(pSubscriber->queueHead + pSubscriber->queueCount) % pSubscriber->queueLength];
+			pEvent->hDevice = pContext->hDevice;
+			CopyMemory(pEvent->bButtonStates, pContext->bButtonStates, sizeof(BOOL) * pSubscriber->Filter.NumberOfButtons);
+			pEvent->lAxisX  = pContext->lAxisX;
+			pEvent->lAxisY  = pContext->lAxisY;
+			pEvent->lAxisZ  = pContext->lAxisZ;
+			pEvent->lAxisRz = pContext->lAxisRz;
+			pEvent->lHat    = pContext->lHat;
+			pEvent->qwTimestamp = qwTimestamp;
+			pSubscriber->queueCount++;
+			pSubscriber->bPending = TRUE;
+			break;
+		}
 	}
 
-	return 0;
+	// Only now that every subscriber has its edges
+	if(firstEdge < MAX_BUTTONS)
+		CopyMemory(pContext->bLastButtonStates, pContext->bButtonStates, sizeof(BOOL) * pContext->NumberOfPlannedButtons);
+}
+
+
+void ParseRawInput(PRAWINPUT pRawInput, LONGLONG qwTimestamp)
+{
+	PDEVICE_CONTEXT pContext;
+
+	pContext = AcquireDeviceContext(pRawInput->header.hDevice);
+	if(!pContext)
+		return;
+
+	if(ParseRawInputReport(pContext, pRawInput))
+		PublishInput(pContext, qwTimestamp);
 }
 
 
+//
+// Everything the input thread does with a report. WM_INPUT and the load
+// generator both come through here; bMorePending tells whether more input is
+// already queued behind this report.
+//
+
+void IngestRawInput(PRAWINPUT pRawInput, LONGLONG qwTimestamp, BOOL bMorePending)
+{
+	ParseRawInput(pRawInput, qwTimestamp);
+	CaptureRawInput(pRawInput);
+	FlushSubscribersAfterReport(bMorePending);
+}
+
 
 //
-// Global variables
+// Synthetic load
+//
+// "-generate <capture>" runs headless and, instead of registering for raw
+// input, feeds virtual devices through IngestRawInput: the same device
+// contexts, field plan, decode and subscribers that WM_INPUT goes through,
+// with more devices and higher rates than real hardware offers. The virtual
+// devices are cloned from the CAPTURE_DEVICE records of a capture, so any
+// layout a real device produced can be replayed, several report IDs and
+// high bit depth values included. The options, with their defaults:
+//
+//   -devices N   virtual devices (16), at most MAX_DEVICES
+//   -rate Hz     reports per second per device (1000)
+//   -burst N     reports per device sent back to back (1)
+//   -churn ms    unplug and replace one device this often, 0 for never (0)
+//   -seconds N   length of the run (10)
+//   -queue N     queue length of the DELIVER_EDGES and DELIVER_EVERY subscribers (64)
+//
+// Reports are stamped with the time they were due, so a path that falls
+// behind shows up as latency. One subscriber per delivery policy stands in
+// for consumers; the DELIVER_EDGES and DELIVER_EVERY ones drain their
+// -queue long queues on every notification, the latter measuring each
+// event's latency, and what did not fit is their dwOverflow. The results go to the console the sample was
+// started from and to the debugger.
 //
 
-BOOL bButtonStates[MAX_BUTTONS];
-LONG lAxisX;
-LONG lAxisY;
-LONG lAxisZ;
-LONG lAxisRz;
-LONG lHat;
-INT  g_NumberOfButtons;
+#define MAX_TEMPLATES		16
+#define MAX_REPORT_IDS		16
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION	0x00000002	// Windows 10 1803 SDK and later
+#endif
 
-void ParseRawInput(PRAWINPUT pRawInput)
+typedef struct _DEVICE_TEMPLATE
 {
 	PHIDP_PREPARSED_DATA pPreparsedData;
+	UINT                 cbPreparsedData;
 	HIDP_CAPS            Caps;
 	PHIDP_BUTTON_CAPS    pButtonCaps;
 	PHIDP_VALUE_CAPS     pValueCaps;
-	USHORT               capsLength;
-	UINT                 bufferSize;
-	HANDLE               hHeap;
-	USAGE                usage[MAX_BUTTONS];
-	ULONG                i, usageLength, value;
+	UCHAR                ReportIds[MAX_REPORT_IDS];	// of button and value caps alike
+	UINT                 NumberOfReportIds;
+} DEVICE_TEMPLATE, *PDEVICE_TEMPLATE;
 
-	pPreparsedData = NULL;
-	pButtonCaps    = NULL;
-	pValueCaps     = NULL;
-	hHeap          = GetProcessHeap();
+typedef struct _VIRTUAL_DEVICE
+{
+	HANDLE           hDevice;
+	PDEVICE_TEMPLATE pTemplate;
+	ULONG            Phase;			// reports sent so far
+} VIRTUAL_DEVICE, *PVIRTUAL_DEVICE;
 
-	//
-	// Get the preparsed data block
-	//
+typedef struct _GENERATOR
+{
+	UINT NumberOfDevices;
+	UINT Rate;
+	UINT Burst;
+	UINT ChurnMs;
+	UINT Seconds;
+	UINT QueueLength;
+} GENERATOR;
+
+GENERATOR       g_Generator = { 16, 1000, 1, 0, 10, 64 };
+DEVICE_TEMPLATE g_Templates[MAX_TEMPLATES];
+UINT            g_NumberOfTemplates;
+VIRTUAL_DEVICE  g_VirtualDevices[MAX_DEVICES];
+UINT_PTR        g_NextVirtualDevice = 0x10000;	// well clear of real device handles
+PRAWINPUT       g_pSyntheticInput;
+
+ULONGLONG       g_qwGenerated;
+ULONGLONG       g_qwBuildFailures;	// HidP_* calls that failed while building a report
+ULONGLONG       g_qwHotplugs;
+ULONGLONG       g_qwLatestNotifications;
+ULONGLONG       g_qwEdgeNotifications;
+ULONGLONG       g_qwEdges;
+ULONGLONG       g_qwEvents;
+LONGLONG        g_qwLatencySum;		// over g_qwEvents
+LONGLONG        g_qwLatencyMax;
+
+
+BOOL ParseGeneratorOptions(LPSTR lpCmdLine)
+{
+	static const struct
+	{
+		const char *pszName;
+		UINT       *pValue;
+		UINT        minimum;
+	} Options[] =
+	{
+		{ "-devices ", &g_Generator.NumberOfDevices, 1 },
+		{ "-rate ",    &g_Generator.Rate,            1 },
+		{ "-burst ",   &g_Generator.Burst,           1 },
+		{ "-churn ",   &g_Generator.ChurnMs,         0 },
+		{ "-seconds ", &g_Generator.Seconds,         1 },
+		{ "-queue ",   &g_Generator.QueueLength,     1 },
+	};
+	LPSTR pszArg;
+	UINT  i;
+
+	for(i = 0; i < ARRAY_SIZE(Options); i++)
+	{
+		pszArg = strstr(lpCmdLine, Options[i].pszName);
+		if(!pszArg)
+			continue;
 
-	CHECK( GetRawInputDeviceInfo(pRawInput->header.hDevice, RIDI_PREPARSEDDATA, NULL, &bufferSize) == 0 );
-	CHECK( pPreparsedData = (PHIDP_PREPARSED_DATA)HeapAlloc(hHeap, 0, bufferSize) );
-	CHECK( (int)GetRawInputDeviceInfo(pRawInput->header.hDevice, RIDI_PREPARSEDDATA, pPreparsedData, &bufferSize) >= 0 );
+		*Options[i].pValue = strtoul(pszArg + strlen(Options[i].pszName), NULL, 10);
+		if(*Options[i].pValue < Options[i].minimum)
+			return FALSE;
+	}
 
-	//
-	// Get the joystick's capabilities
-	//
+	return g_Generator.NumberOfDevices <= MAX_DEVICES;
+}
 
-	// Button caps
-	CHECK( HidP_GetCaps(pPreparsedData, &Caps) == HIDP_STATUS_SUCCESS )
-	CHECK( pButtonCaps = (PHIDP_BUTTON_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_BUTTON_CAPS) * Caps.NumberInputButtonCaps) );
 
-	capsLength = Caps.NumberInputButtonCaps;
-	CHECK( HidP_GetButtonCaps(HidP_Input, pButtonCaps, &capsLength, pPreparsedData) == HIDP_STATUS_SUCCESS )
-	g_NumberOfButtons = pButtonCaps->Range.UsageMax - pButtonCaps->Range.UsageMin + 1;
+void CloseDeviceTemplate(PDEVICE_TEMPLATE pTemplate)
+{
+	HANDLE hHeap = GetProcessHeap();
 
-	// Value caps
-	CHECK( pValueCaps = (PHIDP_VALUE_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_VALUE_CAPS) * Caps.NumberInputValueCaps) );
-	capsLength = Caps.NumberInputValueCaps;
-	CHECK( HidP_GetValueCaps(HidP_Input, pValueCaps, &capsLength, pPreparsedData) == HIDP_STATUS_SUCCESS )
+	SAFE_FREE(pTemplate->pPreparsedData);
+	SAFE_FREE(pTemplate->pButtonCaps);
+	SAFE_FREE(pTemplate->pValueCaps);
+}
 
-	//
-	// Get the pressed buttons
-	//
 
-	usageLength = g_NumberOfButtons;
-	CHECK(
-		HidP_GetUsages(
-			HidP_Input, pButtonCaps->UsagePage, 0, usage, &usageLength, pPreparsedData,
-			(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid
-		) == HIDP_STATUS_SUCCESS );
+void AddTemplateReportId(PDEVICE_TEMPLATE pTemplate, UCHAR reportId)
+{
+	UINT i;
+
+	for(i = 0; i < pTemplate->NumberOfReportIds; i++)
+	{
+		if(pTemplate->ReportIds[i] == reportId)
+			return;
+	}
+	if(pTemplate->NumberOfReportIds < MAX_REPORT_IDS)
+		pTemplate->ReportIds[pTemplate->NumberOfReportIds++] = reportId;
+}
+
+
+//
+// Takes ownership of the preparsed data
+//
+
+BOOL OpenDeviceTemplate(PDEVICE_TEMPLATE pTemplate, PHIDP_PREPARSED_DATA pPreparsedData, UINT cbPreparsedData)
+{
+	USHORT capsLength, i;
+	HANDLE hHeap;
+
+	ZeroMemory(pTemplate, sizeof(*pTemplate));
+	pTemplate->pPreparsedData  = pPreparsedData;
+	pTemplate->cbPreparsedData = cbPreparsedData;
+	hHeap                      = GetProcessHeap();
+
+	CHECK( HidP_GetCaps(pTemplate->pPreparsedData, &pTemplate->Caps) == HIDP_STATUS_SUCCESS )
+	CHECK( pTemplate->Caps.InputReportByteLength > 0 )
+
+	CHECK( pTemplate->pButtonCaps = (PHIDP_BUTTON_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_BUTTON_CAPS) * pTemplate->Caps.NumberInputButtonCaps) );
+	capsLength = pTemplate->Caps.NumberInputButtonCaps;
+	CHECK( HidP_GetButtonCaps(HidP_Input, pTemplate->pButtonCaps, &capsLength, pTemplate->pPreparsedData) == HIDP_STATUS_SUCCESS )
+
+	CHECK( pTemplate->pValueCaps = (PHIDP_VALUE_CAPS)HeapAlloc(hHeap, 0, sizeof(HIDP_VALUE_CAPS) * pTemplate->Caps.NumberInputValueCaps) );
+	capsLength = pTemplate->Caps.NumberInputValueCaps;
+	CHECK( HidP_GetValueCaps(HidP_Input, pTemplate->pValueCaps, &capsLength, pTemplate->pPreparsedData) == HIDP_STATUS_SUCCESS )
+
+	// Every input report gets its turn, the ones with only buttons as well
+	for(i = 0; i < pTemplate->Caps.NumberInputButtonCaps; i++)
+		AddTemplateReportId(pTemplate, pTemplate->pButtonCaps[i].ReportID);
+	for(i = 0; i < pTemplate->Caps.NumberInputValueCaps; i++)
+		AddTemplateReportId(pTemplate, pTemplate->pValueCaps[i].ReportID);
+	CHECK( pTemplate->NumberOfReportIds > 0 )
+
+	return TRUE;
+
+Error:
+	CloseDeviceTemplate(pTemplate);
+	return FALSE;
+}
+
+
+BOOL LoadDeviceTemplates(const char *pszPath)
+{
+	CAPTURE_FILE_HEADER   fileHeader;
+	CAPTURE_RECORD_HEADER header;
+	PHIDP_PREPARSED_DATA  pPreparsedData;
+	FILE                 *pFile;
+	HANDLE                hHeap;
+
+	if(fopen_s(&pFile, pszPath, "rb") != 0)
+		return FALSE;
+
+	hHeap = GetProcessHeap();
+	if(fread(&fileHeader, sizeof(fileHeader), 1, pFile) == 1 && fileHeader.dwMagic == CAPTURE_MAGIC && fileHeader.dwVersion == CAPTURE_VERSION)
+	{
+		while(g_NumberOfTemplates < MAX_TEMPLATES && fread(&header, sizeof(header), 1, pFile) == 1)
+		{
+			if(header.dwType != CAPTURE_DEVICE)
+			{
+				if(_fseeki64(pFile, header.cbData, SEEK_CUR) != 0)
+					break;
+				continue;
+			}
+
+			pPreparsedData = (PHIDP_PREPARSED_DATA)HeapAlloc(hHeap, 0, header.cbData);
+			if(!pPreparsedData)
+				break;
+			if(fread(pPreparsedData, 1, header.cbData, pFile) != header.cbData)
+			{
+				HeapFree(hHeap, 0, pPreparsedData);
+				break;
+			}
+
+			if(OpenDeviceTemplate(&g_Templates[g_NumberOfTemplates], pPreparsedData, header.cbData))
+				g_NumberOfTemplates++;
+		}
+	}
+
+	fclose(pFile);
+	return g_NumberOfTemplates > 0;
+}
+
+
+//
+// What GIDC_ARRIVAL and GIDC_REMOVAL do for a real device
+//
+
+BOOL PlugVirtualDevice(PVIRTUAL_DEVICE pVirtual, PDEVICE_TEMPLATE pTemplate)
+{
+	pVirtual->hDevice   = (HANDLE)g_NextVirtualDevice++;
+	pVirtual->pTemplate = pTemplate;
+	pVirtual->Phase     = 0;
+
+	return AddVirtualDeviceContext(pVirtual->hDevice, pTemplate->pPreparsedData, pTemplate->cbPreparsedData) != NULL;
+}
+
+
+void UnplugVirtualDevice(PVIRTUAL_DEVICE pVirtual)
+{
+	ReleaseDeviceContext(pVirtual->hDevice);
+	CaptureDeviceRemoval(pVirtual->hDevice);
+	g_qwHotplugs++;
+}
+
+
+//
+// Build the device's next report in g_pSyntheticInput and ingest it
+//
+
+void EmitReport(PVIRTUAL_DEVICE pVirtual, LONGLONG qwTimestamp, BOOL bMorePending)
+{
+	PDEVICE_TEMPLATE  pTemplate;
+	PHIDP_BUTTON_CAPS pButtonCaps;
+	PHIDP_VALUE_CAPS  pValueCaps;
+	PRAWINPUT         pRawInput;
+	PCHAR             pReport;
+	ULONG             cbReport, value, i, usageLength;
+	LONGLONG          span;
+	UCHAR             reportId;
+	USAGE             usage;
+
+	pTemplate   = pVirtual->pTemplate;
+	pButtonCaps = pTemplate->pButtonCaps;
+	pValueCaps  = pTemplate->pValueCaps;
+	cbReport    = pTemplate->Caps.InputReportByteLength;
+
+	pRawInput = g_pSyntheticInput;
+	pRawInput->header.dwType      = RIM_TYPEHID;
+	pRawInput->header.dwSize      = FIELD_OFFSET(RAWINPUT, data.hid.bRawData) + cbReport;
+	pRawInput->header.hDevice     = pVirtual->hDevice;
+	pRawInput->header.wParam      = RIM_INPUT;
+	pRawInput->data.hid.dwSizeHid = cbReport;
+	pRawInput->data.hid.dwCount   = 1;
+	pReport = (PCHAR)pRawInput->data.hid.bRawData;
+
+	reportId = pTemplate->ReportIds[pVirtual->Phase % pTemplate->NumberOfReportIds];
+	if(HidP_InitializeReportForID(HidP_Input, reportId, pTemplate->pPreparsedData, pReport, cbReport) != HIDP_STATUS_SUCCESS)
+		g_qwBuildFailures++;
+
+	// Sweep every value of the report through its logical range
+	for(i = 0; i < pTemplate->Caps.NumberInputValueCaps; i++)
+	{
+		if(pValueCaps[i].ReportID != reportId)
+			continue;
+
+		// Up to 2^32 values for a full range 32 bit field
+		span  = (LONGLONG)pValueCaps[i].LogicalMax - pValueCaps[i].LogicalMin;
+		value = (ULONG)pValueCaps[i].LogicalMin;
+		if(span > 0)
+			value += (ULONG)((pVirtual->Phase * 97ULL + i * 31) % (ULONGLONG)(span + 1));
+
+		// Fails for value caps with a ReportCount above 1, among others
+		if(HidP_SetUsageValue(HidP_Input, pValueCaps[i].UsagePage, 0, pValueCaps[i].Range.UsageMin, value,
+			pTemplate->pPreparsedData, pReport, cbReport) != HIDP_STATUS_SUCCESS)
+			g_qwBuildFailures++;
+	}
+
+	// Hold one button of the first button cap down for a while, then the next
+	if(pTemplate->Caps.NumberInputButtonCaps && pButtonCaps->ReportID == reportId)
+	{
+		usage = pButtonCaps->Range.UsageMin;
+		if(pButtonCaps->IsRange && pButtonCaps->Range.UsageMax > pButtonCaps->Range.UsageMin)
+			usage += (USAGE)((pVirtual->Phase / 16) % (pButtonCaps->Range.UsageMax - pButtonCaps->Range.UsageMin + 1));
+		usageLength = 1;
+		if(HidP_SetUsages(HidP_Input, pButtonCaps->UsagePage, 0, &usage, &usageLength,
+			pTemplate->pPreparsedData, pReport, cbReport) != HIDP_STATUS_SUCCESS)
+			g_qwBuildFailures++;
+	}
+
+	pVirtual->Phase++;
+	g_qwGenerated++;
+
+	IngestRawInput(pRawInput, qwTimestamp, bMorePending);
+}
+
+
+void LatestNotify(PSUBSCRIBER pSubscriber)
+{
+	g_qwLatestNotifications++;
+}
+
+
+void EdgeNotify(PSUBSCRIBER pSubscriber)
+{
+	INPUT_EDGE edge;
+
+	g_qwEdgeNotifications++;
+	while(PopInputEdge(pSubscriber, &edge))
+		g_qwEdges++;
+}
+
+
+void EveryNotify(PSUBSCRIBER pSubscriber)
+{
+	INPUT_EVENT   event;
+	LARGE_INTEGER now;
+	LONGLONG      latency;
+
+	QueryPerformanceCounter(&now);
+	while(PopInputEvent(pSubscriber, &event))
+	{
+		latency = now.QuadPart - event.qwTimestamp;
+		g_qwLatencySum += latency;
+		if(latency > g_qwLatencyMax)
+			g_qwLatencyMax = latency;
+		g_qwEvents++;
+	}
+}
+
+
+void PrintGeneratorReport(const char *psz)
+{
+	fputs(psz, stdout);
+	OutputDebugStringA(psz);
+}
+
+
+int RunGenerator(void)
+{
+	static const INPUT_FILTER AllFilter     = { FIELD_ALL, MAX_BUTTONS };
+	static const INPUT_FILTER ButtonsFilter = { 0, 4 };
+	PSUBSCRIBER     pEdges, pEvery;
+	PVIRTUAL_DEVICE pVirtual;
+	LARGE_INTEGER   frequency, start, now, dueTime;
+	LONGLONG        elapsed, ticks, due, scheduled;
+	HANDLE          hTimer;
+	BOOL            bTimerPeriod;
+	UINT            i, j, churned, cbInput;
+	FILE           *pConsole;
+	double          seconds, latencyUnit;
+	char            buf[512];
+
+	Subscribe(DELIVER_LATEST, &AllFilter, LatestNotify, 0);
+	pEdges = Subscribe(DELIVER_EDGES, &ButtonsFilter, EdgeNotify, g_Generator.QueueLength);
+	pEvery = Subscribe(DELIVER_EVERY, &AllFilter, EveryNotify, g_Generator.QueueLength);
+	if(!pEdges || !pEvery)
+		return -1;
+
+	cbInput = 0;
+	for(i = 0; i < g_NumberOfTemplates; i++)
+	{
+		if(g_Templates[i].Caps.InputReportByteLength > cbInput)
+			cbInput = g_Templates[i].Caps.InputReportByteLength;
+	}
+	g_pSyntheticInput = (PRAWINPUT)HeapAlloc(GetProcessHeap(), 0, FIELD_OFFSET(RAWINPUT, data.hid.bRawData) + cbInput);
+	if(!g_pSyntheticInput)
+		return -1;
 
-	ZeroMemory(bButtonStates, sizeof(bButtonStates));
-	for(i = 0; i < usageLength; i++)
-		bButtonStates[usage[i] - pButtonCaps->Range.UsageMin] = TRUE;
+	for(i = 0; i < g_Generator.NumberOfDevices; i++)
+	{
+		if(!PlugVirtualDevice(&g_VirtualDevices[i], &g_Templates[i % g_NumberOfTemplates]))
+			return -1;
+	}
 
 	//
-	// Get the state of discrete-valued-controls
+	// Wait for the next tick on a high resolution timer; where there is none,
+	// raise the system timer resolution for a plain one. Sleep would round
+	// to the default 15.6 ms tick.
 	//
 
-	for(i = 0; i < Caps.NumberInputValueCaps; i++)
+	bTimerPeriod = FALSE;
+	hTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if(!hTimer)
 	{
-		CHECK(
-			HidP_GetUsageValue(
-				HidP_Input, pValueCaps[i].UsagePage, 0, pValueCaps[i].Range.UsageMin, &value, pPreparsedData,
-				(PCHAR)pRawInput->data.hid.bRawData, pRawInput->data.hid.dwSizeHid
-			) == HIDP_STATUS_SUCCESS );
+		bTimerPeriod = timeBeginPeriod(1) == TIMERR_NOERROR;
+		hTimer = CreateWaitableTimer(NULL, TRUE, NULL);
+		if(!hTimer)
+			return -1;
+	}
 
-		switch(pValueCaps[i].Range.UsageMin)
-		{
-		case 0x30:	// X-axis
-			lAxisX = (LONG)(value - 32768) / 256;
-			break;
+	//
+	// Tick n is due n * Burst / Rate seconds into the run and sends one
+	// burst from every device
+	//
 
-		case 0x31:	// Y-axis
-			lAxisY = (LONG)(value - 32768) / 256;
-			break;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+	ticks   = 0;
+	churned = 0;
 
-		case 0x33:
-			lAxisZ = (LONG)(value - 32768) / 256;
+	for(;;)
+	{
+		QueryPerformanceCounter(&now);
+		elapsed = now.QuadPart - start.QuadPart;
+		if(elapsed >= (LONGLONG)g_Generator.Seconds * frequency.QuadPart)
 			break;
 
-		case 0x34:
-			lAxisRz = (LONG)(value - 32768) / 256;
-			break;
+		// Hotplug churn replaces the devices round robin
+		if(g_Generator.ChurnMs && elapsed * 1000 / frequency.QuadPart >= (LONGLONG)(churned + 1) * g_Generator.ChurnMs)
+		{
+			pVirtual = &g_VirtualDevices[churned % g_Generator.NumberOfDevices];
+			UnplugVirtualDevice(pVirtual);
+			PlugVirtualDevice(pVirtual, &g_Templates[(churned + g_Generator.NumberOfDevices) % g_NumberOfTemplates]);
+			churned++;
+		}
 
-		case 0x39:	// Hat Switch
-			lHat = value;
-			break;
+		due = elapsed * g_Generator.Rate / g_Generator.Burst / frequency.QuadPart + 1;
+		if(ticks >= due)
+		{
+			// Relative due time in 100 ns units
+			dueTime.QuadPart = -((ticks * g_Generator.Burst * frequency.QuadPart / g_Generator.Rate - elapsed) * 10000000 / frequency.QuadPart);
+			if(dueTime.QuadPart < 0 && SetWaitableTimer(hTimer, &dueTime, 0, NULL, NULL, FALSE))
+				WaitForSingleObject(hTimer, INFINITE);
+			continue;
+		}
+
+		// Like GetQueueStatus for WM_INPUT, more is pending until the last
+		// report of the last tick that is due
+		scheduled = start.QuadPart + ticks * g_Generator.Burst * frequency.QuadPart / g_Generator.Rate;
+		for(i = 0; i < g_Generator.NumberOfDevices; i++)
+		{
+			for(j = 0; j < g_Generator.Burst; j++)
+				EmitReport(&g_VirtualDevices[i], scheduled, i + 1 < g_Generator.NumberOfDevices || j + 1 < g_Generator.Burst || ticks + 1 < due);
 		}
+		ticks++;
 	}
 
+	QueryPerformanceCounter(&now);
+	seconds = (double)(now.QuadPart - start.QuadPart) / frequency.QuadPart;
+	FlushSubscribers();
+
+	CloseHandle(hTimer);
+	if(bTimerPeriod)
+		timeEndPeriod(1);
+
 	//
-	// Clean up
+	// Report to the console the sample was started from
 	//
 
-Error:
-	SAFE_FREE(pPreparsedData);
-	SAFE_FREE(pButtonCaps);
-	SAFE_FREE(pValueCaps);
+	if(AttachConsole(ATTACH_PARENT_PROCESS))
+		freopen_s(&pConsole, "CONOUT$", "w", stdout);
+
+	latencyUnit = 1000000.0 / frequency.QuadPart;
+
+	sprintf_s(buf, "%llu reports in %.3f s: %.0f reports/s of %u requested from %u devices, %u templates\n",
+		g_qwGenerated, seconds, g_qwGenerated / seconds, g_Generator.NumberOfDevices * g_Generator.Rate,
+		g_Generator.NumberOfDevices, g_NumberOfTemplates);
+	PrintGeneratorReport(buf);
+	sprintf_s(buf, "DELIVER_LATEST: %llu notifications\nDELIVER_EDGES: %llu notifications, %llu edges, %lu overflowed\n",
+		g_qwLatestNotifications, g_qwEdgeNotifications, g_qwEdges, pEdges->dwOverflow);
+	PrintGeneratorReport(buf);
+	sprintf_s(buf, "DELIVER_EVERY: %llu events, %lu overflowed a %u event queue, latency %.1f us average, %.1f us max\n",
+		g_qwEvents, pEvery->dwOverflow, g_Generator.QueueLength,
+		g_qwEvents ? g_qwLatencySum * latencyUnit / g_qwEvents : 0.0, g_qwLatencyMax * latencyUnit);
+	PrintGeneratorReport(buf);
+	sprintf_s(buf, "%llu reports not decoded, %llu HidP_* calls failed building reports, %llu hotplugs, %u bytes of device arenas\n",
+		g_qwGenerated - g_qwEvents - pEvery->dwOverflow, g_qwBuildFailures, g_qwHotplugs, g_DeviceArenaBytes);
+	PrintGeneratorReport(buf);
+	fflush(stdout);
+
+	return 0;
 }
 
 
@@ -328,18 +1784,34 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			// Draw the buttons and axis-values
 			//
 
-			PAINTSTRUCT ps;
-			HDC         hDC;
-			int         i;
+			static DEVICE_CONTEXT NoDevice;
+			PDEVICE_CONTEXT       pContext;
+			PAINTSTRUCT           ps;
+			HDC                   hDC;
+			int                   i;
+
+			// The device that reported last
+			pContext = FindDeviceContext(g_hLastDevice);
+			if(!pContext)
+				pContext = &NoDevice;
 
 			hDC = BeginPaint(hWnd, &ps);
 			SetBkMode(hDC, TRANSPARENT);
 
-			for(i = 0; i < g_NumberOfButtons; i++)
-				DrawButton(hDC, i+1, 20 + i * 40, 20, bButtonStates[i]);
-			DrawCrosshair(hDC, 20, 100, lAxisX, lAxisY);
-			DrawCrosshair(hDC, 296, 100, lAxisZ, lAxisRz);
-			DrawDPad(hDC, 600, 140, lHat);
+			for(i = 0; i < pContext->NumberOfPlannedButtons; i++)
+				DrawButton(hDC, i+1, 20 + i * 40, 20, pContext->bButtonStates[i]);
+			DrawCrosshair(hDC, 20, 100, pContext->lAxisX, pContext->lAxisY);
+			DrawCrosshair(hDC, 296, 100, pContext->lAxisZ, pContext->lAxisRz);
+			DrawDPad(hDC, 600, 140, pContext->lHat);
+
+			if(g_VerifySampleRate)
+			{
+				char sz[MAX_PATH + 128];
+
+				sprintf_s(sz, "Verifying 1 in %u reports: %u mismatching reports, logged to %s",
+					g_VerifySampleRate, g_VerifyMismatches, g_szVerifyLog);
+				TextOutA(hDC, 20, 380, sz, (int)strlen(sz));
+			}
 
 			EndPaint(hWnd, &ps);
 		}
@@ -353,6 +1825,13 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 	return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
+
+void RepaintNotify(PSUBSCRIBER pSubscriber)
+{
+	InvalidateRect(g_hWnd, NULL, TRUE);
+	UpdateWindow(g_hWnd);
+}
+
 void CALLBACK tick(HWND hWnd, UINT Arg2, UINT_PTR Arg3, DWORD Arg4)
 {
 }
@@ -362,7 +1841,68 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	HWND hWnd;
 	MSG msg;
 	WNDCLASSEX wcex;
+	LPSTR pszArg;
+
+
+	//
+	// Optional shadow verification, "-verify N" checks 1 in N reports
+	//
+
+	pszArg = strstr(lpCmdLine, "-verify");
+	if(pszArg)
+	{
+		g_VerifySampleRate = strtoul(pszArg + strlen("-verify"), NULL, 10);
+		if(g_VerifySampleRate == 0)
+			g_VerifySampleRate = 1;
+	}
+
+	pszArg = strstr(lpCmdLine, "-mismatchlog ");
+	if(pszArg)
+	{
+		if(sscanf_s(pszArg, "-mismatchlog %259s", g_szVerifyLog, (unsigned)sizeof(g_szVerifyLog)) != 1)
+			return -1;
+	}
+	else
+	{
+		GetTempPathA(MAX_PATH, g_szVerifyLog);
+		strcat_s(g_szVerifyLog, "RawInputVerify.rcap");
+	}
+
+	//
+	// Optional input capture for offline decoding, "-capture <file>"
+	//
+
+	pszArg = strstr(lpCmdLine, "-capture ");
+	if(pszArg)
+	{
+		char path[MAX_PATH];
+
+		if(sscanf_s(pszArg, "-capture %259s", path, (unsigned)sizeof(path)) != 1 || !OpenCaptureFile(path))
+			return -1;
+	}
+
+	//
+	// Optional synthetic load instead of devices, "-generate <capture>"
+	//
 
+	pszArg = strstr(lpCmdLine, "-generate ");
+	if(pszArg)
+	{
+		char path[MAX_PATH];
+		int  ret;
+
+		if(sscanf_s(pszArg, "-generate %259s", path, (unsigned)sizeof(path)) != 1 || !ParseGeneratorOptions(lpCmdLine) || !LoadDeviceTemplates(path))
+			return -1;
+
+		ret = RunGenerator();
+
+		if(g_pCaptureFile)
+			fclose(g_pCaptureFile);
+		if(g_pVerifyLog)
+			fclose(g_pVerifyLog);
+
+		return ret;
+	}
 
 	SDL_HelperWindowCreate();
 
@@ -394,6 +1934,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	ShowWindow(hWnd, nShowCmd);
 	UpdateWindow(hWnd);
 
+	static const INPUT_FILTER RepaintFilter = { FIELD_ALL, MAX_BUTTONS };
+	Subscribe(DELIVER_LATEST, &RepaintFilter, RepaintNotify, 0);
+
 
 	//
 // Register for joystick devices
@@ -425,5 +1968,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 		DispatchMessage(&msg);
 	}
 
+	if(g_pCaptureFile)
+		fclose(g_pCaptureFile);
+	if(g_pVerifyLog)
+		fclose(g_pVerifyLog);
+
 	return (int)msg.wParam;
 }
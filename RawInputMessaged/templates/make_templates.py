@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+#
+# Writes the device template captures for "Raw Input.exe" -generate.
+#
+# Each capture holds a session record and one device record whose payload is
+# hand built HID preparsed data. HID.DLL does not document that layout; the
+# one written here follows the reconstruction in hidapi's
+# windows/hidapi_descriptor_reconstruct.h (header, 104 byte caps, 16 byte link
+# collection nodes). Run it from this directory to regenerate the .rcap files.
+#
+
+import struct
+
+CAPTURE_MAGIC         = 0x50414352
+CAPTURE_VERSION       = 1
+CAPTURE_DEVICE        = 1
+CAPTURE_SESSION       = 5
+CAPTURE_AXES_MESSAGED = 0
+FREQUENCY             = 10000000
+
+# hid_pp_cap flags, first bit field member in the low bit
+IS_BUTTON_CAP = 0x04
+IS_ABSOLUTE   = 0x08
+IS_RANGE      = 0x10
+
+HID_DATA_VAR_ABS = 0x02
+HID_NULL_STATE   = 0x40
+
+
+class Cap:
+	def __init__(self, report_id, byte, bit, size, count, usage_page, usage_min, usage_max=None,
+			logical_min=0, logical_max=1, has_null=False, button=False):
+		self.report_id   = report_id
+		self.byte        = byte
+		self.bit         = bit
+		self.size        = size
+		self.count       = count
+		self.usage_page  = usage_page
+		self.usage_min   = usage_min
+		self.usage_max   = usage_min if usage_max is None else usage_max
+		self.logical_min = logical_min
+		self.logical_max = logical_max
+		self.has_null    = has_null
+		self.button      = button
+
+	def pack(self, data_index):
+		bits      = self.bit + self.size * self.count
+		flags     = IS_ABSOLUTE | (IS_BUTTON_CAP if self.button else 0) | (IS_RANGE if self.usage_max != self.usage_min else 0)
+		bit_field = HID_DATA_VAR_ABS | (HID_NULL_STATE if self.has_null else 0)
+		last      = data_index + (self.usage_max - self.usage_min)
+
+		cap  = struct.pack('<HBBHHHHIHHHH', self.usage_page, self.report_id, self.bit, self.size, self.count,
+			self.byte, self.size * self.count, bit_field, self.byte + (bits + 7) // 8, 0, 0x01, 0x04)
+		cap += struct.pack('<B3x', flags)
+		cap += bytes(32)	# UnknownTokens
+		cap += struct.pack('<8H', self.usage_min, self.usage_max, 0, 0, 0, 0, data_index, last)
+		if self.button:
+			cap += struct.pack('<iIii4x', 0, 0, self.logical_min, self.logical_max)
+		else:
+			cap += struct.pack('<B3xiiii', self.has_null, self.logical_min, self.logical_max, 0, 0)
+		cap += struct.pack('<II', 0, 0)
+		assert len(cap) == 104
+		return cap, last + 1
+
+
+def preparsed_data(caps, report_length):
+	data  = b'HidP KDR'
+	data += struct.pack('<HH4x', 0x04, 0x01)	# Joystick
+	data += struct.pack('<4H', 0, len(caps), len(caps), report_length)
+	data += struct.pack('<4H', 0, 0, 0, 0)	# no output reports
+	data += struct.pack('<4H', 0, 0, 0, 0)	# no feature reports
+	data += struct.pack('<HH', len(caps) * 104, 1)
+	assert len(data) == 44
+
+	data_index = 0
+	for cap in caps:
+		packed, data_index = cap.pack(data_index)
+		data += packed
+
+	# The one application collection
+	data += struct.pack('<6HI', 0x04, 0x01, 0, 0, 0, 0, 0x01)
+	return data
+
+
+def write_capture(path, device, data):
+	with open(path, 'wb') as f:
+		f.write(struct.pack('<IIQ', CAPTURE_MAGIC, CAPTURE_VERSION, FREQUENCY))
+		f.write(struct.pack('<IIQQ', CAPTURE_SESSION, 16, 0, 0))
+		f.write(struct.pack('<QII', FREQUENCY, CAPTURE_AXES_MESSAGED, 0))
+		f.write(struct.pack('<IIQQ', CAPTURE_DEVICE, len(data), device, 0))
+		f.write(data)
+
+
+def axes(report_id, byte, size, logical_min, logical_max):
+	# X, Y, Z, Rx, Ry, Rz, covering the axes of both samples
+	return [Cap(report_id, byte + i * size // 8, 0, size, 1, 0x01, 0x30 + i,
+		logical_min=logical_min, logical_max=logical_max) for i in range(6)]
+
+
+# Report 1: six 16 bit axes and a hat switch; report 2: 16 buttons only
+multi = axes(1, 1, 16, 0, 65535)
+multi.append(Cap(1, 13, 0, 4, 1, 0x01, 0x39, logical_min=0, logical_max=7, has_null=True))
+multi.append(Cap(2, 1, 0, 1, 16, 0x09, 1, 16, button=True))
+write_capture('MultiReportGamepad.rcap', 1, preparsed_data(multi, 14))
+
+# No report IDs: X and Y full range signed 32 bit, Z to Rz 24 bit, 32 buttons
+high  = axes(0, 1, 32, -2147483648, 2147483647)[:2]
+high += [Cap(0, 9 + i * 3, 0, 24, 1, 0x01, 0x32 + i, logical_min=0, logical_max=16777215) for i in range(4)]
+high.append(Cap(0, 21, 0, 1, 32, 0x09, 1, 32, button=True))
+write_capture('HighResolutionJoystick.rcap', 2, preparsed_data(high, 25))